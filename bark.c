@@ -1,7 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*How long (in ms) and how many search nodes an automated player may use on
+ * one move before it must play the best move it has found (0 nodes means 
+ * no node limit), and the number of cards left in the deck at which 's' 
+ * players stop deepening and search straight to the end of the game. These
+ * can be overridden with BARK_MOVE_MS, BARK_MOVE_NODES and BARK_ENDGAME.*/
+#define MOVE_MS 1000
+#define MOVE_NODES 0
+#define ENDGAME_CARDS 3
+#define SOLVER_TABLE_SIZE (1 << 16)
+
+/*Opening book: 's' players look the first turns up in BOOK_FILE (or the 
+ * file named by BARK_BOOK). The builder stores BOOK_TURNS turns by default
+ * and picks each move by searching BOOK_DEPTH turns ahead.*/
+#define BOOK_FILE "bark.book"
+#define BOOK_MAGIC "BARKBK03"
+#define BOOK_TURNS 3
+#define BOOK_DEPTH 3
+
+/*Position cache: when BARK_CACHE names a file, 's' players keep their 
+ * search results in it, mapped shared so every process using the file 
+ * sees them and they last between runs. It holds CACHE_SLOTS results in 
+ * buckets of CACHE_BUCKET, and only searches at least CACHE_DEPTH turns 
+ * deep are kept.*/
+#define CACHE_MAGIC "BARKPC01"
+#define CACHE_SLOTS (1 << 20)
+#define CACHE_BUCKET 4
+#define CACHE_DEPTH 2
+
+/*Game lengths in bark -stats are counted in power of two buckets, enough
+ * for a full 101x101 board*/
+#define STATS_LENGTHS 15
+
+/*Move times in bark -stats are counted in power of two microsecond 
+ * buckets, up to about 30 seconds*/
+#define STATS_LATENCIES 25
+
+/*Bark -stats keeps a count for every possible score and for each tenth of
+ * the deck used*/
+#define STATS_SCORES (RANK_LIMIT + 1)
+#define STATS_USED 11
+
+/*bark -analyze plays positions out until both players' chances of winning
+ * are known to within its precision (ANALYZE_PRECISION unless one is 
+ * given) at the confidence ANALYZE_Z standard errors give, playing at 
+ * least ANALYZE_MIN_GAMES games*/
+#define ANALYZE_PRECISION 0.01
+#define ANALYZE_Z 1.96
+#define ANALYZE_MIN_GAMES 100
+
+/*bark -export writes training records to shard files that start with an
+ * EXPORT_HEADER byte header (see struct Shard). A shard is laid out 
+ * EXPORT_FIRST bytes at first and doubles as it fills, at most EXPORT_CHUNK
+ * bytes at a time.*/
+#define EXPORT_MAGIC "BARKTD01"
+#define EXPORT_HEADER 64
+#define EXPORT_FIRST (1L << 20)
+#define EXPORT_CHUNK (1L << 28)
+
+/*Boards of more than DENSE_CELLS cells are stored sparsely in 
+ * TILE_SIZE x TILE_SIZE tiles, indexed TILE_GROUP x TILE_GROUP tiles at a
+ * time, up to BOARD_LIMIT x BOARD_LIMIT, and only VIEW_WIDTH x VIEW_HEIGHT
+ * cells around their cards are drawn*/
+#define DENSE_CELLS (1 << 20)
+#define TILE_SIZE 32
+#define TILE_GROUP 64
+#define BOARD_LIMIT 100000
+#define VIEW_WIDTH 40
+#define VIEW_HEIGHT 25
+
+/*Sparse boards and boards of at least SCORE_PARALLEL_CELLS cells are 
+ * scored at the end of the game by parallel_scores, on one thread per core
+ * (or BARK_SCORE_THREADS threads)*/
+#define SCORE_PARALLEL_CELLS (1 << 12)
+
+/*Automatic checkpoints: with BARK_AUTOSAVE naming a savefile, the game is
+ * saved there every AUTOSAVE_TURNS turns or AUTOSAVE_SECONDS seconds, 
+ * whichever comes first (BARK_AUTOSAVE_TURNS and BARK_AUTOSAVE_SECONDS 
+ * override them)*/
+#define AUTOSAVE_TURNS 10
+#define AUTOSAVE_SECONDS 30
+
+/*Saving again to the same savefile appends a delta record of what changed
+ * instead of rewriting the board. The file is compacted back to a single 
+ * full board once it holds SAVE_DELTAS deltas, or more bytes of deltas 
+ * than of board. BARK_SAVE_POINT=n loads the game as it was at the nth 
+ * delta (0 for the full board before them) instead of the last.*/
+#define SAVE_DELTAS 64
+
+/*The 'g' player's weights are read from PARAMS_FILE (or the file named by
+ * BARK_PARAMS), as written by bark -tune, when a 'g' player or the tuner is in
+ * use. The tuner plays TUNE_ITERATIONS rounds of SPSA unless told otherwise,
+ * each a match of up to the given number of games played TUNE_BATCH pairs at a
+ * time, which stops once TUNE_Z standard errors separate the two sides (after
+ * at least TUNE_MIN_PAIRS pairs). TUNE_STEP and TUNE_PERTURB are SPSA's step
+ * and perturbation sizes and weights stay within TUNE_LIMIT of 0.*/
+#define PARAMS_FILE "bark.params"
+#define TUNE_ITERATIONS 20
+#define TUNE_BATCH 64
+#define TUNE_MIN_PAIRS 64
+#define TUNE_Z 2.5
+#define TUNE_STEP 0.5
+#define TUNE_PERTURB 0.3
+#define TUNE_LIMIT 5.0
+
+/*Scripted human input (BARK_SCRIPT) is read from pipes in blocks of 
+ * SCRIPT_BLOCK bytes, and lines longer than SCRIPT_LINE are cut short*/
+#define SCRIPT_BLOCK (1 << 20)
+#define SCRIPT_LINE 256
+
+/*Game events are published to a ring of EVENT_SLOTS events in the POSIX
+ * shared memory object named by BARK_EVENTS, for bark -watch and other 
+ * readers. The ring is off when BARK_EVENTS is not set.*/
+#define EVENT_MAGIC "BARKEV01"
+#define EVENT_SLOTS 4096
+#define EVENT_START 1
+#define EVENT_HAND 2
+#define EVENT_PLACE 3
+#define EVENT_SAVE 4
+#define EVENT_SCORE 5
+
+/*Every player type accepted on the command line. h = human, a = automated,
+ * s = searching automated, g = greedy automated, e = external engine (the
+ * command in BARK_ENGINE)*/
+#define PLAYER_TYPES "hasge"
+
+/*The rules of the game: cards in a full hand, the highest rank, the 
+ * smallest deck, the board size limits, which player a suit scores for and
+ * whether the board wraps around its edges. The standard game has them as
+ * constants so every check and loop on them is compiled for those values.
+ * Building with -DBARK_VARIANTS (make bark-variants) reads them from the 
+ * rules file named by BARK_RULES instead, for variant tables. HAND_LIMIT
+ * and RANK_LIMIT are what arrays are sized for. Ranks past 9 are written 
+ * a, b, c... in deck and save files, so every card stays two characters.*/
+#ifdef BARK_VARIANTS
+#define HAND_LIMIT 16
+#define RANK_LIMIT 35
+#define HAND_SIZE (rules.handSize)
+#define TOP_RANK (rules.topRank)
+#define MIN_DECK (rules.minDeck)
+#define MIN_SIZE (rules.minSize)
+#define MAX_SIZE (rules.maxSize)
+#define TORUS (rules.torus)
+#define PLAYER_OF(suit) (rules.p1Suits[0] == '\0' ? 2 - (suit) % 2 : \
+        (strchr(rules.p1Suits, (suit)) != NULL ? 1 : 2))
+#define RANK_CHAR(number) ((number) < 10 ? '0' + (number) : \
+        'a' + (number) - 10)
+#define RANK_VALUE(c) (isdigit(c) ? (c) - '0' : \
+        (islower(c) ? (c) - 'a' + 10 : -1))
+#else
+#define HAND_LIMIT 6
+#define RANK_LIMIT 9
+#define HAND_SIZE 6
+#define TOP_RANK 9
+#define MIN_DECK 11
+#define MIN_SIZE 2
+#define MAX_SIZE 101
+#define TORUS 1
+#define PLAYER_OF(suit) (2 - (suit) % 2)
+#define RANK_CHAR(number) ('0' + (number))
+#define RANK_VALUE(c) ((c) - '0')
+#endif
+
+/*Weights of what the 'g' player values in a placement: its own and the 
+ * other player's best score once the card is down, the rank of the card
+ * played, and the number of cards next to the cell lower and higher than 
+ * it (the paths it can extend). The standard weights only count the 
+ * scores. PARAM_COUNT weights, in the order of paramNames.*/
+struct Params {
+    double own;
+    double theirs;
+    double rank;
+    double lower;
+    double higher;
+};
+
+#define PARAM_COUNT 5
+
+char* paramNames[PARAM_COUNT] = {"own", "theirs", "rank", "lower", "higher"};
+
+struct Params params = {1, 1, 0, 0, 0};
 
 struct Card* init_deck(char* file, int* deckCount);
 struct Card** create_board(int width, int height);
@@ -10,6 +208,170 @@ int is_free(int pos, struct Card** board, int width, int height, int row,
 void cal_score(struct Card** board, int width, int height);
 int is_game_over(struct Card** board, int* deckCount, int* emptyCards, 
         int width, int height);
+void ai(int player, struct Card* theHand, struct Card** board, struct Card* 
+        deck, int* deckCount, int* handCount, int* emptyCards, 
+        int width, int height);
+void greedy_turn(int player, struct Card* theHand, struct Card** board, 
+        struct Card* deck, int* deckCount, int* handCount, int* emptyCards,
+        int width, int height, struct Params* weights);
+long auto_turn(char type, int player, struct Card* theHand, 
+        struct Card** board, struct Card* deck, int* deckCount, 
+        int* handCount, int* emptyCards, int width, int height, 
+        struct Card* opHand, struct Params* weights);
+int is_legal(struct Card** board, int width, int height, int row, int col);
+int path_score(struct Card** board, int w, int h, int col, int row, 
+        char suit, int steps);
+void best_scores(struct Card** board, int w, int h, int* cells, int count, 
+        int* p1, int* p2);
+void parallel_scores(struct Card** board, int w, int h, int* p1, int* p2);
+long* legal_cells(struct Card** board, int w, int h, long* count);
+struct Card* board_cell(struct Card** board, int col, int row);
+struct Greedy;
+void greedy_place(struct Greedy* greedy, struct Card** board, int col, 
+        int row, struct Card card);
+struct Frontier;
+struct Frontier* frontier_state(struct Card** board, int w, int h);
+void frontier_place(struct Frontier* frontier, struct Card** board, int col,
+        int row);
+void log_cell(struct Card** board, int col, int row);
+void forget_board(struct Card** board);
+void ponder_start(char type, int player, struct Card* theHand, int handCount,
+        struct Card* opHand, int opCount, struct Card** board, 
+        struct Card* deck, int deckCount, int emptyCards, int width, 
+        int height);
+void recall_result(char* p1, char* p2, struct Card** board, int w, int h, 
+        struct Card* deck, int deckCount, int emptyCards, 
+        struct Card* p1Hand, struct Card* p2Hand, int turn);
+void store_result(int p1, int p2);
+
+/*Set when games are played in bulk (bark -stats), turning off the board, 
+ * hand and move printing*/
+int quiet = 0;
+
+#ifdef BARK_VARIANTS
+/*The rules of a variant table (see HAND_SIZE and the rest). Suits listed 
+ * in p1Suits score for player 1 and all others for player 2; when it is 
+ * empty odd suits go to player 1 as in the standard game.*/
+struct Rules {
+    int handSize;
+    int topRank;
+    int minDeck;
+    int minSize;
+    int maxSize;
+    int torus;
+    char p1Suits[60];
+};
+
+struct Rules rules = {6, 9, 11, 2, 101, 1, ""};
+
+/*Reads the rules file named by BARK_RULES, when set, over the standard 
+ * rules. Each line is a name and a value: hand, ranks, deck, minsize, 
+ * maxsize, torus (1 or 0) or p1suits (the suit letters player 1 scores 
+ * for). Lines starting with # are skipped. Exits if the file cannot be 
+ * read or a rule is out of range.*/
+void load_rules(void) {
+    char* file = getenv("BARK_RULES");
+    char line[100];
+    char name[20];
+    char value[60];
+    int bad = 0;
+    if (file == NULL) {
+        return;
+    }
+    FILE* input = fopen(file, "r");
+    if (input == NULL) {
+        fprintf(stderr, "Unable to parse rules\n");
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), input) != NULL) {
+        if (sscanf(line, "%19s %59s", name, value) != 2 || *name == '#') {
+            continue;
+        }
+        if (strcmp(name, "hand") == 0) {
+            rules.handSize = atoi(value);
+        } else if (strcmp(name, "ranks") == 0) {
+            rules.topRank = atoi(value);
+        } else if (strcmp(name, "deck") == 0) {
+            rules.minDeck = atoi(value);
+        } else if (strcmp(name, "minsize") == 0) {
+            rules.minSize = atoi(value);
+        } else if (strcmp(name, "maxsize") == 0) {
+            rules.maxSize = atoi(value);
+        } else if (strcmp(name, "torus") == 0) {
+            rules.torus = atoi(value) != 0;
+        } else if (strcmp(name, "p1suits") == 0) {
+            strcpy(rules.p1Suits, value);
+        } else {
+            bad = 1;
+        }
+    }
+    fclose(input);
+    /*Both hands are dealt HAND_SIZE - 1 cards and the first player draws
+     * one more, so a shorter deck could not be dealt*/
+    if (rules.minDeck < rules.handSize * 2 - 1) {
+        rules.minDeck = rules.handSize * 2 - 1;
+    }
+    if (bad || rules.handSize < 2 || rules.handSize > HAND_LIMIT || 
+            rules.topRank < 1 || rules.topRank > RANK_LIMIT || 
+            rules.minSize < 1 || rules.maxSize < rules.minSize || 
+            rules.maxSize > BOARD_LIMIT) {
+        fprintf(stderr, "Unable to parse rules\n");
+        exit(1);
+    }
+}
+#endif
+
+/*Returns where weight name is kept in weights, or NULL if there is no 
+ * such weight*/
+double* param_of(struct Params* weights, char* name) {
+    double* values[PARAM_COUNT] = {&weights->own, &weights->theirs, 
+            &weights->rank, &weights->lower, &weights->higher};
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        if (strcmp(name, paramNames[i]) == 0) {
+            return values[i];
+        }
+    }
+    return NULL;
+}
+
+/*Set once load_params has run*/
+int paramsLoaded = 0;
+
+/*Reads the 'g' player's weights from the file named by BARK_PARAMS, or 
+ * from PARAMS_FILE if there is one. Each line is a weight's name and its
+ * value, as bark -tune writes them; weights not given keep their standard
+ * values. Exits if a named file cannot be read or has a line it does not
+ * know. Only the first call reads the file; code_check makes it when a 'g'
+ * player is in use, so other games never look at the file.*/
+void load_params(void) {
+    char* file = getenv("BARK_PARAMS");
+    char line[100];
+    char name[20];
+    double value;
+    if (paramsLoaded) {
+        return;
+    }
+    paramsLoaded = 1;
+    FILE* input = fopen((file != NULL) ? file : PARAMS_FILE, "r");
+    if (input == NULL) {
+        if (file != NULL) {
+            fprintf(stderr, "Unable to parse params\n");
+            exit(1);
+        }
+        return;
+    }
+    while (fgets(line, sizeof(line), input) != NULL) {
+        if (sscanf(line, "%19s %lf", name, &value) != 2 || *name == '#') {
+            continue;
+        }
+        if (param_of(&params, name) == NULL) {
+            fprintf(stderr, "Unable to parse params\n");
+            exit(1);
+        }
+        *param_of(&params, name) = value;
+    }
+    fclose(input);
+}
 
 /*A struct named card made in order to store values from a given deckfile
  * as well as a value utilised when calculating the score*/
@@ -19,9 +381,144 @@ struct Card {
     int score;
 };
 
+/*One game event as published to the shared memory ring (64 bytes in the
+ * standard game). Which fields are used depends on type: EVENT_START has 
+ * the board size in col and row, EVENT_HAND the player's hand in cards, 
+ * EVENT_PLACE the card played in cards[0] at col and row, EVENT_SAVE the 
+ * savefile name and EVENT_SCORE the final scores in p1 and p2. stamp is 
+ * owned by the ring.*/
+struct Event {
+    uint64_t stamp;
+    uint32_t type;
+    int32_t player;
+    int32_t col;
+    int32_t row;
+    int32_t p1;
+    int32_t p2;
+    char cards[HAND_LIMIT][2];
+    char name[20];
+};
+
+/*Start of the shared memory ring: head is the sequence number of the next
+ * event to be written. Event n lives in slot n % slots.*/
+struct EventRing {
+    char magic[8];
+    uint32_t slots;
+    uint32_t size;
+    uint64_t head;
+};
+
+/*The ring this game publishes to, or NULL when BARK_EVENTS is not set*/
+struct EventRing* events = NULL;
+pthread_once_t eventsOnce = PTHREAD_ONCE_INIT;
+
+/*Maps the shared memory object at name (e.g. /bark), creating it when 
+ * needed. The producer passes write 1. Returns NULL on failure or if the 
+ * object is not an event ring.*/
+struct EventRing* map_events(char* name, int write) {
+    size_t size = sizeof(struct EventRing) + 
+            sizeof(struct Event) * EVENT_SLOTS;
+    int fd = shm_open(name, write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (write && ftruncate(fd, size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, size, write ? PROT_READ | PROT_WRITE : 
+            PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    struct EventRing* ring = data;
+    if (write && (memcmp(ring->magic, EVENT_MAGIC, 8) != 0 || 
+            ring->slots != EVENT_SLOTS)) {
+        memset(data, 0, size);
+        ring->slots = EVENT_SLOTS;
+        ring->size = sizeof(struct Event);
+        memcpy(ring->magic, EVENT_MAGIC, 8);
+    }
+    if (memcmp(ring->magic, EVENT_MAGIC, 8) != 0 || 
+            ring->size != sizeof(struct Event)) {
+        munmap(data, size);
+        return NULL;
+    }
+    return ring;
+}
+
+/*Opens the ring named by BARK_EVENTS for publishing*/
+void open_events(void) {
+    char* name = getenv("BARK_EVENTS");
+    if (name != NULL) {
+        events = map_events(name, 1);
+    }
+}
+
+/*Returns an empty event of the given type for player*/
+struct Event new_event(int type, int player) {
+    struct Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.player = player;
+    return event;
+}
+
+/*Publishes an event to the ring. There is only one writer (the game), so
+ * head is simply bumped; readers are never waited for. Each slot's stamp is
+ * odd while it is being written and 2n + 2 once it holds event n, which 
+ * lets a reader tell if it read a whole event or was overtaken.*/
+void publish_event(struct Event* event) {
+    if (quiet) {
+        return;
+    }
+    pthread_once(&eventsOnce, open_events);
+    if (events == NULL) {
+        return;
+    }
+    struct Event* slots = (struct Event*)(events + 1);
+    uint64_t n = events->head;
+    struct Event* slot = &slots[n % EVENT_SLOTS];
+    __atomic_store_n(&slot->stamp, n * 2 + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char*)slot + sizeof(uint64_t), (char*)event + sizeof(uint64_t), 
+            sizeof(struct Event) - sizeof(uint64_t));
+    __atomic_store_n(&slot->stamp, n * 2 + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&events->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/*Publishes a placement event for the card at col and row*/
+void publish_play(int player, struct Card** board, int col, int row) {
+    struct Event event = new_event(EVENT_PLACE, player);
+    event.cards[0][0] = board_cell(board, col, row)->number;
+    event.cards[0][1] = board_cell(board, col, row)->suit;
+    event.col = col;
+    event.row = row;
+    publish_event(&event);
+}
+
+/*Reads event n from the ring into event. Returns 1 if it was read, 0 if it
+ * has not been published yet and -1 if the writer has already overwritten
+ * it (the reader fell more than EVENT_SLOTS events behind).*/
+int read_event(struct EventRing* ring, uint64_t n, struct Event* event) {
+    struct Event* slot = (struct Event*)(ring + 1) + n % EVENT_SLOTS;
+    uint64_t stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+    if (stamp < n * 2 + 2) {
+        return (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > n + 
+                EVENT_SLOTS) ? -1 : 0;
+    } else if (stamp > n * 2 + 2) {
+        return -1;
+    }
+    memcpy(event, slot, sizeof(struct Event));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) == stamp) ? 1 : -1;
+}
+
 /*reads the line of a given file and returns it as a char* (string)*/
 char* read_line(FILE* file) {
-    char* result = malloc(sizeof(char) * 40);
+    int space = 40;
+    char* result = malloc(sizeof(char) * space);
     int position = 0;
     int next = 0;
     while (1) {
@@ -30,6 +527,10 @@ char* read_line(FILE* file) {
             result[position] = '\0';
             return result;
         } else {
+            if (position == space - 1) {
+                space *= 2;
+                result = realloc(result, sizeof(char) * space);
+            }
             result[position++] = (char)next;
         }
     }
@@ -47,7 +548,7 @@ struct Card* init_deck(char* file, int* deckCount) {
     }
     int numberOfCards;
     numberOfCards = atoi(read_line(gameFile));
-    if (numberOfCards < 11) {
+    if (numberOfCards < MIN_DECK) {
         fprintf(stderr, "Short deck\n");
         exit(5);
     } 
@@ -65,12 +566,12 @@ struct Card* init_deck(char* file, int* deckCount) {
         }
         char suit = temp[1];
         char val = temp[0];
-        int number = val - '0';
+        int number = RANK_VALUE(val);
 
         if (isalpha(suit) == 0) {
             fprintf(stderr, "Unable to parse deckfile");
             exit(3);
-        } else if (number > 9 || number < 1) {
+        } else if (number > TOP_RANK || number < 1) {
             fprintf(stderr, "Unable to parse deckfile");
             exit(3);
         }
@@ -87,32 +588,236 @@ struct Card* init_deck(char* file, int* deckCount) {
 }
 
 /*checks given parameters are within the given constraints and exits 
- * using a specific number when they do not fall within*/
+ * using a specific number when they do not fall within. Loads the 'g' 
+ * player's weights if either player is one.*/
 void code_check(char* p1, char* p2, int width, int height) {
-    if (width < 2 || width > 101 || height < 2 || height > 101) {
+    if (width < MIN_SIZE || width > MAX_SIZE || height < MIN_SIZE || 
+            height > MAX_SIZE) {
         fprintf(stderr, "Incorrect arg types\n");
         exit(2);
     }
-    if (strcmp(p1, "a") && strcmp(p1, "h")) {
+    if (strlen(p1) != 1 || strchr(PLAYER_TYPES, *p1) == NULL) {
         fprintf(stderr, "Incorrect arg types\n");
         exit(2);
     }
-    if (strcmp(p2, "a") && strcmp(p2, "h")) {
+    if (strlen(p2) != 1 || strchr(PLAYER_TYPES, *p2) == NULL) {
         fprintf(stderr, "Incorrect arg types\n");
         exit(2);
     }
+    if (*p1 == 'g' || *p2 == 'g') {
+        load_params();
+    }
+}
+
+/*The cells of a sparse board. The board is split into TILE_SIZE square 
+ * tiles, numbered row by row, and a tile's cells (row by row) are only 
+ * allocated when one of them is first written to; until then it reads as
+ * emptyTile. list has the tiles written to, in the order they were first
+ * written, with their cells in blocks, so scans only visit those tiles. 
+ * A tile's place in list (plus one, 0 for a tile not written to) is found
+ * in two steps: the tiles are grouped TILE_GROUP x TILE_GROUP, groups has
+ * a table of places for each of its groupCount groups (NULL until one of
+ * its tiles is written to) and groupsAcross is the number of groups in a 
+ * row. cards counts the
+ * cards on the board. A board keeps its Tiles in the slot before column 0
+ * (NULL for dense boards), its Greedy (see greedy_state) in the slot 
+ * before that and its Frontier (see frontier_state) before that.*/
+struct Tiles {
+    int width;
+    int height;
+    int across;
+    long cards;
+    int* list;
+    struct Card** blocks;
+    int count;
+    int space;
+    int** groups;
+    int groupCount;
+    int groupsAcross;
+};
+
+/*What every cell of a sparse board's unwritten tiles, and every cell off
+ * its edges, reads as. It is never written to.*/
+struct Card emptyTile[TILE_SIZE * TILE_SIZE];
+
+/*Returns the tile index of a sparse board, or NULL for a dense board*/
+struct Tiles* board_tiles(struct Card** board) {
+    return (struct Tiles*)(void*)board[-1];
+}
+
+/*Returns what 'g' players keep about a board, or NULL if none has played
+ * on it*/
+struct Greedy* board_greedy(struct Card** board) {
+    return (struct Greedy*)(void*)board[-2];
+}
+
+/*Returns the cells next to a board's cards, or NULL if no automated 
+ * player has needed them yet*/
+struct Frontier* board_frontier(struct Card** board) {
+    return (struct Frontier*)(void*)board[-3];
+}
+
+/*Where the place in tiles->list (plus one) of the tile in tile column 
+ * across and tile row down is kept. Returns NULL if no tile of its group 
+ * has been written to, unless add is set, when the group's table is made.*/
+int* tile_entry(struct Tiles* tiles, int across, int down, int add) {
+    int** group = &tiles->groups[down / TILE_GROUP * tiles->groupsAcross + 
+            across / TILE_GROUP];
+    if (*group == NULL) {
+        if (!add) {
+            return NULL;
+        }
+        *group = calloc(TILE_GROUP * TILE_GROUP, sizeof(int));
+    }
+    return *group + down % TILE_GROUP * TILE_GROUP + across % TILE_GROUP;
+}
+
+/*Place in tiles->list of tile plus one, or 0 if it has not been written 
+ * to*/
+int tile_slot(struct Tiles* tiles, int tile) {
+    int* entry = tile_entry(tiles, tile % tiles->across, 
+            tile / tiles->across, 0);
+    return (entry != NULL) ? *entry : 0;
+}
+
+/*Like tile_slot, but allocates the tile's cells (all empty) first if it 
+ * has not been written to*/
+int tile_add(struct Tiles* tiles, int tile) {
+    int* entry = tile_entry(tiles, tile % tiles->across, 
+            tile / tiles->across, 1);
+    if (*entry != 0) {
+        return *entry;
+    }
+    if (tiles->count == tiles->space) {
+        tiles->space = (tiles->space == 0) ? 16 : tiles->space * 2;
+        tiles->list = realloc(tiles->list, sizeof(int) * tiles->space);
+        tiles->blocks = realloc(tiles->blocks, sizeof(struct Card*) * 
+                tiles->space);
+    }
+    tiles->list[tiles->count] = tile;
+    tiles->blocks[tiles->count] = calloc(TILE_SIZE * TILE_SIZE, 
+            sizeof(struct Card));
+    if (tiles->blocks[tiles->count] == NULL) {
+        fprintf(stderr, "Board too big\n");
+        exit(2);
+    }
+    *entry = ++tiles->count;
+    return *entry;
+}
+
+/*The card at col and row of board. Cells of a sparse board that have not
+ * been written to, or are off its edges, are read from emptyTile and must
+ * not be written to; board_slot gives a cell that can be.*/
+struct Card* board_cell(struct Card** board, int col, int row) {
+    struct Tiles* tiles = board_tiles(board);
+    if (tiles == NULL) {
+        return &board[col][row];
+    }
+    if (col < 1 || row < 1 || col > tiles->width || row > tiles->height) {
+        return emptyTile;
+    }
+    int* entry = tile_entry(tiles, (col - 1) / TILE_SIZE, 
+            (row - 1) / TILE_SIZE, 0);
+    return ((entry == NULL || *entry == 0) ? emptyTile : 
+            tiles->blocks[*entry - 1]) + (row - 1) % TILE_SIZE * TILE_SIZE +
+            (col - 1) % TILE_SIZE;
+}
+
+/*The card at col and row of board (on the board), for writing to: a sparse
+ * board's tile is allocated if it has not been yet*/
+struct Card* board_slot(struct Card** board, int col, int row) {
+    struct Tiles* tiles = board_tiles(board);
+    if (tiles == NULL) {
+        return &board[col][row];
+    }
+    int slot = tile_add(tiles, (row - 1) / TILE_SIZE * tiles->across + 
+            (col - 1) / TILE_SIZE);
+    return tiles->blocks[slot - 1] + (row - 1) % TILE_SIZE * TILE_SIZE + 
+            (col - 1) % TILE_SIZE;
+}
+
+/*Steps through the cards of a sparse board tile by tile. Start with 
+ * *position at 0; each call moves col and row to the next card and returns
+ * 0 when there are no more.*/
+int next_card(struct Tiles* tiles, struct Card** board, long* position, 
+        int* col, int* row) {
+    while (*position / (TILE_SIZE * TILE_SIZE) < tiles->count) {
+        int slot = *position / (TILE_SIZE * TILE_SIZE);
+        int tile = tiles->list[slot];
+        int offset = *position % (TILE_SIZE * TILE_SIZE);
+        ++*position;
+        *col = tile % tiles->across * TILE_SIZE + offset % TILE_SIZE + 1;
+        *row = tile / tiles->across * TILE_SIZE + offset / TILE_SIZE + 1;
+        if (tiles->blocks[slot][offset].number != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*Draws the part of a sparse board around its cards: the cells next to 
+ * every card, cut down to VIEW_WIDTH x VIEW_HEIGHT around their middle, 
+ * after a line giving the columns and rows shown*/
+void draw_view(struct Tiles* tiles, struct Card** board) {
+    long position = 0;
+    int col, row;
+    int left = tiles->width;
+    int right = 1;
+    int top = tiles->height;
+    int bottom = 1;
+    while (next_card(tiles, board, &position, &col, &row)) {
+        left = (col - 1 < left) ? col - 1 : left;
+        right = (col + 1 > right) ? col + 1 : right;
+        top = (row - 1 < top) ? row - 1 : top;
+        bottom = (row + 1 > bottom) ? row + 1 : bottom;
+    }
+    if (tiles->cards == 0) {
+        left = right = (tiles->width + 1) / 2;
+        top = bottom = (tiles->height + 1) / 2;
+    }
+    if (right - left + 1 > VIEW_WIDTH) {
+        left = (left + right - VIEW_WIDTH + 1) / 2;
+        right = left + VIEW_WIDTH - 1;
+    }
+    if (bottom - top + 1 > VIEW_HEIGHT) {
+        top = (top + bottom - VIEW_HEIGHT + 1) / 2;
+        bottom = top + VIEW_HEIGHT - 1;
+    }
+    left = (left < 1) ? 1 : left;
+    top = (top < 1) ? 1 : top;
+    right = (right > tiles->width) ? tiles->width : right;
+    bottom = (bottom > tiles->height) ? tiles->height : bottom;
+    printf("Columns %d-%d rows %d-%d\n", left, right, top, bottom);
+    for (int x = top; x < bottom + 1; x++) {
+        for (int y = left; y < right + 1; y++) {
+            struct Card* card = board_cell(board, y, x);
+            if (card->number == 0) {
+                printf("..");
+            } else {
+                printf("%c%c", RANK_CHAR(card->number), card->suit);
+            }
+        }
+        printf("\n");
+    }
 }
 
 /*When called upon the function will draw a current version of the given
  * board including cards and lays the deck out in a width x height
- * format*/
+ * format. Sparse boards only show the part around their cards.*/
 void draw_board(struct Card** board, int width, int height) {   
+    if (quiet) {
+        return;
+    }
+    if (board_tiles(board) != NULL) {
+        draw_view(board_tiles(board), board);
+        return;
+    }
     for (int x = 1; x < height + 1; x++) {
         for (int y = 1; y < width + 1; y++) {
             if (board[y][x].number == 0) {
                 printf(".."); 
             } else {
-                printf("%d%c", board[y][x].number, board[y][x].suit);
+                printf("%c%c", RANK_CHAR(board[y][x].number), board[y][x].suit);
             }
         }
         printf("\n");
@@ -120,14 +825,36 @@ void draw_board(struct Card** board, int width, int height) {
 }
 
 /*Used when starting a new game or loading a saved game. It initializes the
- * board that will be used during that game and sets all spaces to 0 (..)*/
+ * board that will be used during that game and sets all spaces to 0 (..).
+ * Column and row 0 are never played on but are also set, as the corner and
+ * side checks can look at them. Boards of more than DENSE_CELLS cells are
+ * made sparse (see struct Tiles), with no columns: their cells are reached
+ * through board_cell and board_slot, and empty spaces are all zero.*/
 struct Card** create_board(int width, int height) {
-    struct Card** board = malloc(width * (sizeof(struct Card*) * 2));
-    for (int i = 1; i < width + 1; i++) {
+    struct Card** board;
+    if ((long)width * height > DENSE_CELLS) {
+        struct Tiles* tiles = calloc(1, sizeof(struct Tiles));
+        tiles->width = width;
+        tiles->height = height;
+        tiles->across = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tiles->groupsAcross = (tiles->across + TILE_GROUP - 1) / TILE_GROUP;
+        tiles->groupCount = tiles->groupsAcross * ((height + TILE_SIZE * 
+                TILE_GROUP - 1) / (TILE_SIZE * TILE_GROUP));
+        tiles->groups = calloc(tiles->groupCount, sizeof(int*));
+        board = (struct Card**)calloc(4, sizeof(struct Card*)) + 3;
+        board[-1] = (struct Card*)(void*)tiles;
+        return board;
+    }
+    board = (struct Card**)malloc((width * 2 + 3) * sizeof(struct Card*)) + 
+            3;
+    board[-1] = NULL;
+    board[-2] = NULL;
+    board[-3] = NULL;
+    for (int i = 0; i < width + 1; i++) {
         board[i] = (struct Card*)malloc(height * (sizeof(struct Card) * 2));
     }
-    for (int x = 1; x < height + 1; x++) {
-        for (int y = 1; y < width + 1; y++) {
+    for (int x = 0; x < height + 1; x++) {
+        for (int y = 0; y < width + 1; y++) {
             board[y][x].number = 0;
             board[y][x].suit = 0;
             board[y][x].score = 1;
@@ -136,25 +863,137 @@ struct Card** create_board(int width, int height) {
     return board;
 }
 
+/*What 'g' players keep about a board between turns (see greedy_state)*/
+struct Greedy {
+    int width;
+    int height;
+    int p1;
+    int p2;
+    int* seen;
+    int stamp;
+    long* stack;
+    long stackSpace;
+};
+
+/*Frees a board's Greedy, if it has one*/
+void free_greedy(struct Greedy* greedy) {
+    if (greedy != NULL) {
+        free(greedy->seen);
+        free(greedy->stack);
+        free(greedy);
+    }
+}
+
+/*The cells a card may be placed on (see is_legal), as 
+ * (row - 1) * width + col - 1 in no order: none while the board is empty*/
+struct Frontier {
+    int width;
+    int height;
+    long* cells;
+    long count;
+    long space;
+};
+
+/*Frees a board's Frontier, if it has one*/
+void free_frontier(struct Frontier* frontier) {
+    if (frontier != NULL) {
+        free(frontier->cells);
+        free(frontier);
+    }
+}
+
+/*Frees a board made by create_board*/
+void free_board(struct Card** board, int width) {
+    struct Tiles* tiles = board_tiles(board);
+    if (tiles != NULL) {
+        for (int i = 0; i < tiles->count; i++) {
+            free(tiles->blocks[i]);
+        }
+        for (int i = 0; i < tiles->groupCount; i++) {
+            free(tiles->groups[i]);
+        }
+        free(tiles->list);
+        free(tiles->blocks);
+        free(tiles->groups);
+        free(tiles);
+    } else {
+        for (int i = 0; i < width + 1; i++) {
+            free(board[i]);
+        }
+    }
+    free_greedy(board_greedy(board));
+    free_frontier(board_frontier(board));
+    forget_board(board);
+    free(board - 3);
+}
+
+/*Puts card on the board for good (searches that lift their cards again 
+ * write to the board directly), keeping a sparse board's tiles, its 
+ * Greedy and its Frontier up to date, and noting the cell if the board has
+ * been saved (see log_cell)*/
+void place_card(struct Card** board, int col, int row, struct Card card) {
+    struct Tiles* tiles = board_tiles(board);
+    if (card.number != 0 && board_cell(board, col, row)->number == 0) {
+        if (board_greedy(board) != NULL) {
+            greedy_place(board_greedy(board), board, col, row, card);
+        }
+        if (board_frontier(board) != NULL) {
+            frontier_place(board_frontier(board), board, col, row);
+        }
+    }
+    log_cell(board, col, row);
+    if (tiles == NULL) {
+        board[col][row] = card;
+        return;
+    }
+    int slot = tile_add(tiles, (row - 1) / TILE_SIZE * tiles->across + 
+            (col - 1) / TILE_SIZE);
+    struct Card* cell = tiles->blocks[slot - 1] + (row - 1) % TILE_SIZE * 
+            TILE_SIZE + (col - 1) % TILE_SIZE;
+    tiles->cards += (cell->number == 0 && card.number != 0);
+    *cell = card;
+}
+
+/*Makes a copy of board with the same cards (and for sparse boards, the 
+ * same tiles)*/
+struct Card** copy_board(struct Card** board, int width, int height) {
+    struct Card** copy = create_board(width, height);
+    struct Tiles* tiles = board_tiles(board);
+    if (tiles != NULL) {
+        long position = 0;
+        int col, row;
+        while (next_card(tiles, board, &position, &col, &row)) {
+            place_card(copy, col, row, *board_cell(board, col, row));
+        }
+        return copy;
+    }
+    for (int i = 1; i < height + 1; i++) {
+        for (int j = 1; j < width + 1; j++) {
+            copy[j][i] = board[j][i];
+        }
+    }
+    return copy;
+}
+
 /*This function is used when either initializing the two players first hand,
- * giving the given player a hand of 6 as the function is called before each
- * platers turn. If the players hand count (a way to track the amount of cards
- * each player has) = 5 it will add a card from the deck to the end of the 
- * hand.*/
+ * giving the given player a hand of HAND_SIZE as the function is called 
+ * before each platers turn. If the players hand count (a way to track the 
+ * amount of cards each player has) = HAND_SIZE - 1 it will add a card from 
+ * the deck to the end of the hand.*/
 struct Card* hand(struct Card* deck, int* deckCount, int* handCount, 
         struct Card* hand, int* emptyCards) {
     if (*emptyCards == *deckCount) {
         return hand;
-    } else if (*handCount == 5) {
-        hand[5] = deck[*emptyCards];
+    } else if (*handCount == HAND_SIZE - 1) {
+        hand[HAND_SIZE - 1] = deck[*emptyCards];
         deck[*emptyCards].number = 0;
         ++*emptyCards;
         ++*handCount;
         return hand;
-    } else if (*handCount == 6) {
+    } else if (*handCount == HAND_SIZE) {
         return hand;
     } else {
-        for (int x = 0; x < 5; x++) {
+        for (int x = 0; x < HAND_SIZE - 1; x++) {
             hand[x] = deck[*emptyCards];
             ++*handCount;
             deck[*emptyCards].number = 0;
@@ -298,10 +1137,16 @@ int side_check(struct Card** board, int row, int col, int width, int height,
  * 1. The board is empty, in which case it is ok to place a card where ever.
  * 2. If board !empty, whether the given row and col is a corner or side
  *       where if neither, it will just search around the card basically.
- * 3. If a corner or side = 1, returns 1 (can be placed)*/
+ * 3. If a corner or side = 1, returns 1 (can be placed)
+ * Boards that do not wrap have no corner or side cases and use is_legal, 
+ * as do sparse boards, which know if they are empty from their tiles.*/
 int board_check(struct Card** board, int row, int col, int width, int height) {
     int emptyBoard = 0;
     int breaks = 0;
+    if (board_tiles(board) != NULL) {
+        return board_tiles(board)->cards == 0 || 
+                is_legal(board, width, height, row, col);
+    }
     for (int i = 1; i < height + 1 && breaks == 0; i++) {
         for (int j = 1; j < width + 1 && breaks == 0; j++) {
             if (board[j][i].number != 0) {
@@ -314,6 +1159,9 @@ int board_check(struct Card** board, int row, int col, int width, int height) {
         if (board[col][row].number != 0) {
             return 0;
         }
+        if (!TORUS) {
+            return is_legal(board, width, height, row, col);
+        }
         int corner = corner_check(board, row, col, width, height, 0);
         int side = side_check(board, row, col, width, height, corner, 0);
         if (corner == 5 && side == 5) {
@@ -336,16 +1184,27 @@ int board_check(struct Card** board, int row, int col, int width, int height) {
     return 0;
 }
 
-/*Prints the hand based on the type of player. Always printing 6 cards*/
+/*Prints the hand based on the type of player. Always printing HAND_SIZE
+ * cards.
+ * The hand is also published as an event.*/
 void print_hand(struct Card* theHand, int player, int type) {
+    struct Event event = new_event(EVENT_HAND, player);
+    for (int x = 0; x < HAND_SIZE; x++) {
+        event.cards[x][0] = theHand[x].number;
+        event.cards[x][1] = theHand[x].suit;
+    }
+    publish_event(&event);
+    if (quiet) {
+        return;
+    }
     if (type) {
         printf("Hand:");
     } else {
         printf("Hand(%d):", player);
     }
-    for (int x = 0; x < 6; x++) {
+    for (int x = 0; x < HAND_SIZE; x++) {
         printf(" ");
-        printf("%d%c", theHand[x].number, theHand[x].suit);
+        printf("%c%c", RANK_CHAR(theHand[x].number), theHand[x].suit);
     }
     printf("\n");
 }
@@ -359,30 +1218,22 @@ void place_shuffle(struct Card* theHand, struct Card** board, int row,
         int col, int card, int* handCount) { 
     int placementIndex = card;
     struct Card placementCard = theHand[placementIndex - 1];
-    for (int i = placementIndex - 1; i < 6; i++) {
-        if (i == 5) {
+    for (int i = placementIndex - 1; i < HAND_SIZE; i++) {
+        if (i == HAND_SIZE - 1) {
             theHand[i].number = 0;
         } else {
             theHand[i] = theHand[i + 1];
         }
     }
     --*handCount;
-    board[col][row] = placementCard;
+    place_card(board, col, row, placementCard);
 }
 
 /*Checks if the save name meets the given constraints, return 1 if so*/
 int check_save(char* saveFile) {
     int alpha = 0;
-    char* legitName = malloc(sizeof(char) * 20);
-    int size = strlen(saveFile);
-    strncpy(legitName, saveFile + 4, size - 4);
-
-    if (legitName == NULL) {
-        fprintf(stdout, "Unable to save\n");
-        return 0;
-    }
-    for (int i = 0; i < strlen(legitName); i++) {
-        if (isalpha(legitName[i])) {
+    for (char* name = saveFile + 4; *name != '\0'; name++) {
+        if (isalpha(*name)) {
             alpha++;
         }
     }
@@ -393,15 +1244,216 @@ int check_save(char* saveFile) {
     return 1;
 }
 
+/*Writes all length bytes of text to fd, returning 0 if it cannot*/
+int write_all(int fd, char* text, size_t length) {
+    for (size_t done = 0; done < length; ) {
+        ssize_t wrote = write(fd, text + done, length - done);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote <= 0) {
+            return 0;
+        }
+        done += wrote;
+    }
+    return 1;
+}
+
+/*Writes length bytes of text to file by way of temp, returning 0 if any
+ * step fails (file is then left as it was)*/
+int write_atomic(char* file, char* temp, char* text, size_t length) {
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    if (!write_all(fd, text, length) || fsync(fd) != 0) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    return rename(temp, file) == 0;
+}
+
+/*Bytes format_save may need for board*/
+size_t save_size(struct Card** board, int width, int height, 
+        char* deckName) {
+    size_t size = 64 + strlen(deckName) + 2 * (HAND_LIMIT * 2 + 1);
+    if (board_tiles(board) != NULL) {
+        return size + 24 + board_tiles(board)->cards * 24;
+    }
+    return size + (size_t)height * (width * 2 + 1);
+}
+
+/*Writes a hand's line of a savefile at out, returning where it ends*/
+char* format_hand(char* out, struct Card* theHand) {
+    for (int i = 0; i < HAND_SIZE && theHand[i].number != 0; i++) {
+        *out++ = RANK_CHAR(theHand[i].number);
+        *out++ = theHand[i].suit;
+    }
+    *out++ = '\n';
+    return out;
+}
+
+/*Writes a savefile into text (at least save_size bytes): the size, cards
+ * dealt and player to move, the deck, both hands and the board. Returns 
+ * its length. A sparse board is written as its number of cards and a 
+ * "col row card" line for each, rather than row by row.*/
+size_t format_save(char* text, int width, int height, int emptyCards, 
+        int player, char* deckName, struct Card* p1Hand, 
+        struct Card* p2Hand, struct Card** board) {
+    struct Tiles* tiles = board_tiles(board);
+    char* out = text;
+    out += sprintf(out, "%d %d %d %d\n%s\n", width, height, emptyCards, 
+            player, deckName);
+    out = format_hand(out, p1Hand);
+    out = format_hand(out, p2Hand);
+    if (tiles != NULL) {
+        long position = 0;
+        int col, row;
+        out += sprintf(out, "%ld\n", tiles->cards);
+        while (next_card(tiles, board, &position, &col, &row)) {
+            struct Card* card = board_cell(board, col, row);
+            out += sprintf(out, "%d %d %c%c\n", col, row, 
+                    RANK_CHAR(card->number), card->suit);
+        }
+        return out - text;
+    }
+    for (int i = 1; i < height + 1; i++) {
+        for (int j = 1; j < width + 1; j++) {
+            struct Card* card = board_cell(board, j, i);
+            if (card->number == 0) {
+                *out++ = '*';
+                *out++ = '*';
+            } else {
+                *out++ = RANK_CHAR(card->number);
+                *out++ = card->suit;
+            }
+        }
+        *out++ = '\n';
+    }
+    return out - text;
+}
+
+/*What save_game last wrote: the file's name, the board it holds (NULL if
+ * none), the cells placed on that board since (count of them, as col and 
+ * row pairs), how many delta records follow its full board and its size in
+ * bytes, all of it (size) and the full board part (baseSize)*/
+struct SaveLog {
+    char name[80];
+    int width;
+    int height;
+    struct Card** board;
+    int* cells;
+    long count;
+    long space;
+    int deltas;
+    long baseSize;
+    long size;
+};
+
+struct SaveLog saveLog;
+
+/*Called by place_card for every card put on a board. Notes the cell if 
+ * the board is the one save_game last wrote, for the next delta record. If
+ * the note cannot be kept the next save is a full one.*/
+void log_cell(struct Card** board, int col, int row) {
+    if (board != saveLog.board) {
+        return;
+    }
+    if (saveLog.count == saveLog.space) {
+        long space = (saveLog.space == 0) ? 64 : saveLog.space * 2;
+        int* cells = realloc(saveLog.cells, sizeof(int) * 2 * space);
+        if (cells == NULL) {
+            saveLog.board = NULL;
+            return;
+        }
+        saveLog.cells = cells;
+        saveLog.space = space;
+    }
+    saveLog.cells[saveLog.count * 2] = col;
+    saveLog.cells[saveLog.count * 2 + 1] = row;
+    saveLog.count++;
+}
+
+/*Called by free_board so a board's cells are not noted for the next board
+ * made at the same address*/
+void forget_board(struct Card** board) {
+    if (board == saveLog.board) {
+        saveLog.board = NULL;
+    }
+}
+
+/*Remembers that name now holds board in full, in size bytes*/
+void log_base(char* name, int width, int height, struct Card** board, 
+        long size) {
+    snprintf(saveLog.name, sizeof(saveLog.name), "%s", name);
+    saveLog.width = width;
+    saveLog.height = height;
+    saveLog.board = board;
+    saveLog.count = 0;
+    saveLog.deltas = 0;
+    saveLog.baseSize = size;
+    saveLog.size = size;
+}
+
+/*Appends a delta record to name: a "+ cards player cells" line, both 
+ * hands in full and a "col row card" line for each card placed since 
+ * save_game last wrote the file. Returns 0, writing nothing, when a full 
+ * save is needed instead: the last save was to another file or board, the
+ * file has been changed since, or it is due to be compacted.*/
+int append_delta(char* name, int width, int height, int emptyCards, 
+        int player, struct Card* p1Hand, struct Card* p2Hand, 
+        struct Card** board) {
+    struct stat info;
+    if (saveLog.board != board || strcmp(saveLog.name, name) != 0 || 
+            saveLog.width != width || saveLog.height != height || 
+            saveLog.deltas >= SAVE_DELTAS || 
+            saveLog.size - saveLog.baseSize > saveLog.baseSize ||
+            stat(name, &info) != 0 || info.st_size != saveLog.size) {
+        return 0;
+    }
+    char* text = malloc(64 + 2 * (HAND_LIMIT * 2 + 1) + saveLog.count * 24);
+    if (text == NULL) {
+        return 0;
+    }
+    char* out = text;
+    out += sprintf(out, "+ %d %d %ld\n", emptyCards, player, saveLog.count);
+    out = format_hand(out, p1Hand);
+    out = format_hand(out, p2Hand);
+    for (long i = 0; i < saveLog.count; i++) {
+        int col = saveLog.cells[i * 2];
+        int row = saveLog.cells[i * 2 + 1];
+        struct Card* card = board_cell(board, col, row);
+        out += sprintf(out, "%d %d %c%c\n", col, row, RANK_CHAR(card->number),
+                card->suit);
+    }
+    FILE* output = fopen(name, "a");
+    if (output == NULL || fwrite(text, 1, out - text, output) != 
+            (size_t)(out - text)) {
+        if (output != NULL) {
+            fclose(output);
+        }
+        free(text);
+        saveLog.board = NULL;
+        return 0;
+    }
+    fclose(output);
+    saveLog.count = 0;
+    saveLog.deltas++;
+    saveLog.size += out - text;
+    free(text);
+    return 1;
+}
+
 /*Save game saves the current state of the game if the humans's savefile 
- * passes the check_save function. If it does, then a file is created,
- * paramaters are printed onto it and the file is closed. The game then
- * continues as normal.*/
+ * passes the check_save function. If the last save went to the same file
+ * only what changed is appended (append_delta), otherwise the whole game 
+ * is written with format_save to a temp file that replaces the savefile. 
+ * The game then continues as normal.*/
 void save_game(char* saveFile, int width, int height, int* emptyCards, 
         int player, char* deckName, struct Card* phand1, 
         struct Card* phand2, struct Card** board) {
-    char* legitName = malloc(sizeof(char) * 80);
-    FILE* outputFile;
+    char legitName[80] = {0};
     struct Card* p1Hand;
     struct Card* p2Hand;
 
@@ -412,92 +1464,281 @@ void save_game(char* saveFile, int width, int height, int* emptyCards,
         p1Hand = phand2;
         p2Hand = phand1;
     }
-    strncpy(legitName, saveFile + 4, strlen(saveFile) - 4);
-    outputFile = fopen(legitName, "w");
+    strncpy(legitName, saveFile + 4, sizeof(legitName) - 1);
     fflush(stdout);
-    fprintf(outputFile, "%d %d %d %d\n", width, height, *emptyCards, player);
-    fprintf(outputFile, "%s\n", deckName);
-    for (int i = 0; i < 6; i++) {
-        if (p1Hand[i].number == 0) {
-            break;
+    if (!append_delta(legitName, width, height, *emptyCards, player, 
+            p1Hand, p2Hand, board)) {
+        char* text = malloc(save_size(board, width, height, deckName));
+        char temp[sizeof(legitName) + 4];
+        size_t length = 0;
+        snprintf(temp, sizeof(temp), "%s.tmp", legitName);
+        if (text != NULL) {
+            length = format_save(text, width, height, *emptyCards, player, 
+                    deckName, p1Hand, p2Hand, board);
         }
-        fprintf(outputFile, "%d%c", p1Hand[i].number, p1Hand[i].suit);
-    }
-    fprintf(outputFile, "\n");
-    for (int i = 0; i < 6; i++) {
-        if (p2Hand[i].number == 0) {
-            break;
+        if (text != NULL && write_atomic(legitName, temp, text, length)) {
+            log_base(legitName, width, height, board, length);
+        } else {
+            fprintf(stdout, "Unable to save\n");
         }
-        fprintf(outputFile, "%d%c", p2Hand[i].number, p2Hand[i].suit);
+        free(text);
     }
-    fprintf(outputFile, "\n");
-    for (int i = 1; i < height + 1; i++) {
-        for (int j = 1; j < width + 1; j++) {
-            if (board[j][i].number == 0) {
-                fprintf(outputFile, "**");
-            } else {
-                fprintf(outputFile, "%d%c", board[j][i].number, 
-                        board[j][i].suit);
-            }
+    struct Event event = new_event(EVENT_SAVE, player);
+    strncpy(event.name, legitName, sizeof(event.name));
+    publish_event(&event);
+}
+
+/*The automatic checkpoints of a game (see AUTOSAVE_TURNS). The game 
+ * thread formats each one into whichever of the two buffers the writer 
+ * thread is not busy with and marks it pending; the writer puts it on disk
+ * through a temp file, fsync and rename, so a crash leaves the last whole
+ * checkpoint in place. A checkpoint still pending when the next one is 
+ * made is replaced by it, so the game never waits for the disk. A buffer
+ * grows when a checkpoint needs more than its size, as a sparse board's 
+ * does with each card. file is NULL when autosaving is off.*/
+struct Autosave {
+    char* file;
+    char* temp;
+    int turns;
+    int seconds;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    char* buffers[2];
+    size_t lengths[2];
+    size_t sizes[2];
+    int pending;
+    int busy;
+    int lastCards;
+    struct timespec last;
+};
+
+struct Autosave autosave;
+int autosaveChecked = 0;
+
+/*Body of the autosave writer thread*/
+void* autosave_thread(void* data) {
+    struct Autosave* save = data;
+    while (1) {
+        pthread_mutex_lock(&save->lock);
+        while (save->pending < 0) {
+            pthread_cond_wait(&save->ready, &save->lock);
         }
-        fprintf(outputFile, "\n");
+        save->busy = save->pending;
+        save->pending = -1;
+        pthread_mutex_unlock(&save->lock);
+        if (!write_atomic(save->file, save->temp, save->buffers[save->busy],
+                save->lengths[save->busy])) {
+            fprintf(stderr, "Unable to autosave\n");
+        }
+        pthread_mutex_lock(&save->lock);
+        save->busy = -1;
+        pthread_mutex_unlock(&save->lock);
     }
-    fflush(outputFile);
-    fclose(outputFile);
+    return NULL;
 }
 
-/*Human turn is a void function which will first check if the game is over, 
- * acting accordningly if so. It then picks up a card form the deck
- * given the hand, and prints the hand. It then prompts the player to enter 
- * paramaters used to place a chosen card on the deck. Using a function before
- * it checks whether the move is valid, assuming the constraints are valid also
- * and then places it, shuffles the hand, and redraws the board. Here a player 
- * can decide whether they want to save the game or not through the prompt.*/
-void human_turn(int player, struct Card* theHand, struct Card** board, 
-        struct Card* deck, int* deckCount, int* handCount, 
-        int* emptyCards, int width, int height, char* deckName, 
-        struct Card* opHand) {
-    if (is_game_over(board, deckCount, emptyCards, width, height)) {
-        cal_score(board, width, height);
-        exit(0);
+/*Sets autosaving up the first time it is asked for, from BARK_AUTOSAVE*/
+void open_autosave(struct Card** board, int width, int height, 
+        char* deckName, int emptyCards) {
+    char* file = getenv("BARK_AUTOSAVE");
+    char* turns = getenv("BARK_AUTOSAVE_TURNS");
+    char* seconds = getenv("BARK_AUTOSAVE_SECONDS");
+    autosaveChecked = 1;
+    autosave.file = NULL;
+    if (file == NULL) {
+        return;
     }
-    hand(deck, deckCount, handCount, theHand, emptyCards);
-    int card, row, col;
-    int type = 0;
-    print_hand(theHand, player, type);
-    while (1) { 
-        printf("Move? "); 
-        char* input = read_line(stdin);
-        if (input == '\0') {
-            continue;
-        } 
-        if (feof(stdin) == 1) {
-            fprintf(stderr, "End of input\n");
-            exit(7);
-        }
-        if (strncmp(input, "SAVE", 4) == 0) {
-            if (check_save(input)) {
-                save_game(input, width, height, emptyCards, player, deckName, 
-                        theHand, opHand, board);
-                continue;
-            }
-            continue;
+    autosave.turns = (turns != NULL && atoi(turns) > 0) ? atoi(turns) : 
+            AUTOSAVE_TURNS;
+    autosave.seconds = (seconds != NULL && atoi(seconds) > 0) ? 
+            atoi(seconds) : AUTOSAVE_SECONDS;
+    autosave.temp = malloc(strlen(file) + 5);
+    for (int i = 0; i < 2; i++) {
+        autosave.sizes[i] = save_size(board, width, height, deckName);
+        autosave.buffers[i] = malloc(autosave.sizes[i]);
+    }
+    if (autosave.temp == NULL || autosave.buffers[0] == NULL || 
+            autosave.buffers[1] == NULL) {
+        fprintf(stderr, "Unable to autosave\n");
+        return;
+    }
+    sprintf(autosave.temp, "%s.tmp", file);
+    autosave.pending = -1;
+    autosave.busy = -1;
+    autosave.lastCards = emptyCards;
+    clock_gettime(CLOCK_MONOTONIC, &autosave.last);
+    pthread_mutex_init(&autosave.lock, NULL);
+    pthread_cond_init(&autosave.ready, NULL);
+    if (pthread_create(&autosave.thread, NULL, autosave_thread, 
+            &autosave) != 0) {
+        return;
+    }
+    autosave.file = file;
+}
+
+/*Called by play_game before each round with player (1 or 2) about to 
+ * move. Makes a checkpoint when enough turns (cards dealt) or time have 
+ * passed since the last one.*/
+void autosave_turn(int player, char* deckName, struct Card* p1Hand, 
+        struct Card* p2Hand, struct Card** board, int emptyCards, 
+        int width, int height) {
+    struct timespec now;
+    if (!autosaveChecked) {
+        open_autosave(board, width, height, deckName, emptyCards);
+    }
+    if (autosave.file == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (emptyCards - autosave.lastCards < autosave.turns && 
+            now.tv_sec - autosave.last.tv_sec < autosave.seconds) {
+        return;
+    }
+    autosave.lastCards = emptyCards;
+    autosave.last = now;
+    pthread_mutex_lock(&autosave.lock);
+    int slot = (autosave.busy == 0) ? 1 : 0;
+    size_t size = save_size(board, width, height, deckName);
+    if (size > autosave.sizes[slot]) {
+        char* buffer = realloc(autosave.buffers[slot], size * 2);
+        if (buffer == NULL) {
+            pthread_mutex_unlock(&autosave.lock);
+            fprintf(stderr, "Unable to autosave\n");
+            return;
         }
-        sscanf(input, "%d %d %d", &card, &col, &row);
-        if (card > 6 || card <= 0) {
-            continue; 
-        } else if (row > height || row <= 0 || col > width || col <= 0) {
-            continue;
-        } else if (strlen(input) < 5) {
-            continue;
-        } else if (board_check(board, row, col, width, height) == 0) {
-            continue; 
-        } else {
-            place_shuffle(theHand, board, row, col, card, handCount);
-            draw_board(board, width, height);
-            break;
-        }   
+        autosave.buffers[slot] = buffer;
+        autosave.sizes[slot] = size * 2;
+    }
+    autosave.lengths[slot] = format_save(autosave.buffers[slot], width, 
+            height, emptyCards, player, deckName, p1Hand, p2Hand, board);
+    autosave.pending = slot;
+    pthread_cond_signal(&autosave.ready);
+    pthread_mutex_unlock(&autosave.lock);
+}
+
+/*Scripted input for human players: when BARK_SCRIPT names a file (or is
+ * "-" for stdin) moves are taken from it instead of being read a byte at a
+ * time with prompts. A file is mapped whole; stdin is read SCRIPT_BLOCK 
+ * bytes at a time.*/
+struct Script {
+    char* data;
+    size_t size;
+    size_t pos;
+    int fd;
+};
+
+struct Script* moveScript = NULL;
+int scriptChecked = 0;
+
+/*Opens BARK_SCRIPT the first time a human player needs a move. Returns 
+ * NULL when it is not set, so moves come from stdin as normal.*/
+struct Script* open_script(void) {
+    struct stat info;
+    char* name = getenv("BARK_SCRIPT");
+    if (scriptChecked) {
+        return moveScript;
+    }
+    scriptChecked = 1;
+    if (name == NULL) {
+        return NULL;
+    }
+    moveScript = malloc(sizeof(struct Script));
+    moveScript->pos = 0;
+    moveScript->size = 0;
+    if (strcmp(name, "-") == 0) {
+        moveScript->fd = 0;
+        moveScript->data = malloc(SCRIPT_BLOCK);
+        return moveScript;
+    }
+    int fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "End of input\n");
+        exit(7);
+    }
+    moveScript->fd = -1;
+    moveScript->size = info.st_size;
+    moveScript->data = (info.st_size == 0) ? NULL : 
+            mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (moveScript->data == MAP_FAILED) {
+        fprintf(stderr, "End of input\n");
+        exit(7);
+    }
+    return moveScript;
+}
+
+/*Copies the next line of the script (without its newline) into line, 
+ * which holds space characters; longer lines are cut short. Returns 0 at 
+ * the end of the input, including a last line with no newline, which 
+ * read_line and feof treat the same way.*/
+int script_line(struct Script* script, char* line, int space) {
+    while (1) {
+        char* start = script->data + script->pos;
+        char* stop = (script->pos < script->size) ? 
+                memchr(start, '\n', script->size - script->pos) : NULL;
+        if (stop != NULL) {
+            int length = stop - start;
+            length = (length < space - 1) ? length : space - 1;
+            memcpy(line, start, length);
+            line[length] = '\0';
+            script->pos = stop - script->data + 1;
+            return 1;
+        }
+        if (script->fd < 0) {
+            return 0;
+        }
+        memmove(script->data, start, script->size - script->pos);
+        script->size -= script->pos;
+        script->pos = 0;
+        if (script->size == SCRIPT_BLOCK) {
+            script->size = 0;
+        }
+        ssize_t got = read(script->fd, script->data + script->size, 
+                SCRIPT_BLOCK - script->size);
+        if (got <= 0) {
+            return 0;
+        }
+        script->size += got;
+    }
+}
+
+/*Reads up to three numbers from a move line the way 
+ * sscanf(input, "%d %d %d", ...) does: each skips leading spaces, takes an
+ * optional sign and digits, and reading stops at the first that fails, 
+ * leaving the rest unchanged.*/
+void parse_move(char* input, int* card, int* col, int* row) {
+    int* values[3] = {card, col, row};
+    for (int i = 0; i < 3; i++) {
+        int sign = 1;
+        int value = 0;
+        while (isspace((unsigned char)*input)) {
+            input++;
+        }
+        if (*input == '-' || *input == '+') {
+            sign = (*input == '-') ? -1 : 1;
+            input++;
+        }
+        if (!isdigit((unsigned char)*input)) {
+            return;
+        }
+        while (isdigit((unsigned char)*input)) {
+            value = value * 10 + (*input++ - '0');
+        }
+        *values[i] = sign * value;
+    }
+}
+
+/*Prints (unless quiet) and publishes the move an automated player just 
+ * made*/
+void print_play(int player, struct Card** board, int col, int row) {
+    publish_play(player, board, col, row);
+    if (quiet) {
+        return;
     }
+    struct Card* card = board_cell(board, col, row);
+    fprintf(stdout, "Player %d plays %c%c in column %d row %d\n", player, 
+            RANK_CHAR(card->number), card->suit, col, row);
 }
 
 /*AI is a function created for the 'a' type or automated, essentially 
@@ -506,7 +1747,8 @@ void human_turn(int player, struct Card* theHand, struct Card** board,
  * the AI's turn is 1, it will search the board from left to right, top to 
  * bottom. If the AI's turn is 2 it will search the board from right to left, 
  * bottom to top. If its the first play, they will place in the center
- * of the board. After every turn it will redraw the deck.*/
+ * of the board. After every turn it will redraw the deck. Only the cells
+ * next to cards (see frontier_state) are searched, in the same order.*/
 void ai(int player, struct Card* theHand, struct Card** board, struct Card* 
         deck, int* deckCount, int* handCount, int* emptyCards, 
         int width, int height) {
@@ -516,54 +1758,31 @@ void ai(int player, struct Card* theHand, struct Card** board, struct Card*
     }
     hand(deck, deckCount, handCount, theHand, emptyCards); 
     print_hand(theHand, player, type);
-    int emptyBoard = 0;
-    int check = 0;
-    for (int i = 1; i < height + 1; i++) {
-        for (int j = 1; j < width + 1; j++) {
-            if (board[j][i].number != 0) {        
-                emptyBoard++;
-            }
-        }
-    } 
-    if (player == 1 && emptyBoard != 0) { 
-        for (int i = 1; i < height + 1 && check == 0; i++) { 
-            for (int j = 1; j < width + 1 && check == 0; j++) { 
-                if (board_check(board, i, j, width, height)) {
-                    place_shuffle(theHand, board, i, j, 1, handCount);
-                    fprintf(stdout, "Player %d plays %d%c in column %d row",
-                            player, board[j][i].number, board[j][i].suit,
-                            j);
-                    fprintf(stdout, " %d\n", i);
-                    check++;
-                }
-            }
-        }
-    } else if (player == 2 && emptyBoard != 0) { 
-        for (int i = height; i > 0 && check == 0; i--) {         
-            for (int j = width; j > 0 && check == 0; j--) {      
-                if (board_check(board, i, j, width, height)) {
-                    place_shuffle(theHand, board, i, j, 1, handCount);
-                    fprintf(stdout, "Player %d plays %d%c in column %d row",
-                            player, board[j][i].number, board[j][i].suit, j);
-                    fprintf(stdout, " %d\n", i);
-                    check++;
-                }
-            }
+    struct Frontier* frontier = frontier_state(board, width, height);
+    long cell = (long)((height + 1) / 2 - 1) * width + (width + 1) / 2 - 1;
+    if (frontier->count == 0 && board_cell(board, cell % width + 1, 
+            cell / width + 1)->number != 0) {
+        draw_board(board, width, height);
+        return;
+    }
+    for (long k = 0; k < frontier->count; k++) {
+        if (k == 0 || (player == 1 && frontier->cells[k] < cell) || 
+                (player == 2 && frontier->cells[k] > cell)) {
+            cell = frontier->cells[k];
         }
-    } else { 
-        place_shuffle(theHand, board, ((height + 1) / 2), ((width + 1) / 2), 1,
-                handCount);
-        fprintf(stdout, "Player %d plays %d%c in column %d row %d\n", player, 
-                board[(width + 1) / 2][(height + 1) / 2].number,
-                board[(width + 1) / 2][(height + 1) / 2].suit, 
-                (width + 1) / 2, (height + 1) / 2);
     }
+    place_shuffle(theHand, board, cell / width + 1, cell % width + 1, 1, 
+            handCount);
+    print_play(player, board, cell % width + 1, cell / width + 1);
     draw_board(board, width, height);
 }
 
 /*Checks if any cards have been placed, or are present on the given board
  * returning 1 if completely full*/
 int is_board_full(struct Card** board, int width, int height) {
+    if (board_tiles(board) != NULL) {
+        return board_tiles(board)->cards == (long)width * height;
+    }
     for (int i = 1; i < height + 1; i++) {
         for (int j = 1; j < width + 1; j++) {
             if (board[j][i].number == 0) {
@@ -587,57 +1806,479 @@ int is_game_over(struct Card** board, int* deckCount, int* emptyCards,
 }
 
 
-/*Play game essentially checks what types the players are, whoses turn is it 
- * (if new game turn = 1), and if the game is over. If the game isnt over, 
- * the function runs playing combonations of h and a types until the game is
- * over or specified otherwise.*/
+/*Input that may not have come yet: human moves on stdin and engine 
+ * replies. What has come is kept here until a whole line is there; lines
+ * longer than the buffer are cut short.*/
+struct LineIn {
+    int fd;
+    int used;
+    int eof;
+    char data[SCRIPT_LINE * 4];
+};
+
+struct LineIn humanInput = {0, 0, 0, {0}};
+
+/*Reads what is waiting on in's descriptor. Only called once poll has 
+ * said it is readable, so it does not block.*/
+void line_fill(struct LineIn* in) {
+    if (in->used == (int)sizeof(in->data)) {
+        in->used = 0;
+    }
+    ssize_t got = read(in->fd, in->data + in->used, 
+            sizeof(in->data) - in->used);
+    if (got < 0 && errno == EINTR) {
+        return;
+    }
+    if (got <= 0) {
+        in->eof = 1;
+    } else {
+        in->used += got;
+    }
+}
+
+/*Takes the next whole line (without its newline) out of in and into line,
+ * which holds space bytes. Returns 1 for a line, 0 if there is no whole 
+ * line yet and -1 once the input has ended.*/
+int line_take(struct LineIn* in, char* line, int space) {
+    char* end = memchr(in->data, '\n', in->used);
+    if (end == NULL) {
+        return in->eof ? -1 : 0;
+    }
+    int length = end - in->data;
+    int kept = (length < space - 1) ? length : space - 1;
+    memcpy(line, in->data, kept);
+    line[kept] = '\0';
+    in->used -= length + 1;
+    memmove(in->data, end + 1, in->used);
+    return 1;
+}
+
+/*An external engine ('e' player): the BARK_ENGINE command, run with its
+ * stdin and stdout on pipes. Its stdin pipe does not block, and what has 
+ * yet to go down it is kept in pending (length bytes, sent of them sent).
+ * failed is set once it has died or made a move that is not allowed, and
+ * an 'a' player takes over.*/
+struct Engine {
+    pid_t pid;
+    int to;
+    char* pending;
+    size_t length;
+    size_t sent;
+    struct LineIn from;
+    int failed;
+};
+
+/*A game being played: what play_game used to pass around and whose turn 
+ * it is. A turn that has to wait for input is resumed where it left off:
+ * started says the player's card has been dealt, card, col and row hold 
+ * the human's last try, wait is the descriptor waited on (-1 for none), 
+ * waitEvents the poll events waited for (POLLIN unless a move says 
+ * otherwise) and ready is set by run_games once they come. over is set 
+ * once the game has been scored, and autosave if it may be autosaved.*/
+struct Game {
+    char types[2];
+    char* deckName;
+    struct Card* hands[2];
+    int handCounts[2];
+    struct Card** board;
+    struct Card* deck;
+    int deckCount;
+    int emptyCards;
+    int width;
+    int height;
+    int turn;
+    int started;
+    int card;
+    int col;
+    int row;
+    int wait;
+    short waitEvents;
+    int ready;
+    int over;
+    int autosave;
+    int number;
+    struct Engine* engines[2];
+};
+
+/*A type of player. move plays (or carries on with) the turn of player (1
+ * or 2) in game, returning 1 once its card is down, or 0 if it has to 
+ * wait for input, with the game's wait set to the descriptor to watch.*/
+struct Player {
+    char type;
+    int (*move)(struct Game* game, int player);
+};
+
+/*Handles a line typed by a human at the prompt: SAVE and a file name 
+ * saves the game, otherwise the line is a card, column and row, placed 
+ * if the move is allowed. A line that does not give all three keeps the
+ * missing ones from the last try. Returns 1 once the card is down.*/
+int human_line(struct Game* game, int player, char* input) {
+    int side = player - 1;
+    if (strncmp(input, "SAVE", 4) == 0) {
+        if (check_save(input)) {
+            save_game(input, game->width, game->height, &game->emptyCards, 
+                    player, game->deckName, game->hands[side], 
+                    game->hands[1 - side], game->board);
+        }
+        return 0;
+    }
+    if (open_script() != NULL) {
+        parse_move(input, &game->card, &game->col, &game->row);
+    } else {
+        sscanf(input, "%d %d %d", &game->card, &game->col, &game->row);
+    }
+    if (game->card > HAND_SIZE || game->card <= 0) {
+        return 0;
+    } else if (game->row > game->height || game->row <= 0 || 
+            game->col > game->width || game->col <= 0) {
+        return 0;
+    } else if (strlen(input) < 5) {
+        return 0;
+    } else if (board_check(game->board, game->row, game->col, game->width, 
+            game->height) == 0) {
+        return 0;
+    }
+    place_shuffle(game->hands[side], game->board, game->row, game->col, 
+            game->card, &game->handCounts[side]);
+    publish_play(player, game->board, game->col, game->row);
+    draw_board(game->board, game->width, game->height);
+    return 1;
+}
+
+/*Human turns. The turn starts by dealing the human a card, printing the 
+ * hand and prompting for a move, which is checked by human_line; the 
+ * prompt is repeated until a move is allowed. While the move has not been
+ * typed the game waits on stdin. With BARK_SCRIPT set the moves come from
+ * the script instead, with no prompt, and never wait. An 's' opponent 
+ * ponders while the human thinks.*/
+int human_move(struct Game* game, int player) {
+    struct Script* script = open_script();
+    char line[SCRIPT_LINE];
+    int side = player - 1;
+    if (!game->started) {
+        ponder_start(game->types[1 - side], 3 - player, game->hands[1 - side],
+                game->handCounts[1 - side], game->hands[side], 
+                game->handCounts[side], game->board, game->deck, 
+                game->deckCount, game->emptyCards, game->width, 
+                game->height);
+        hand(game->deck, &game->deckCount, &game->handCounts[side], 
+                game->hands[side], &game->emptyCards);
+        print_hand(game->hands[side], player, 0);
+        game->started = 1;
+        game->card = game->col = game->row = 0;
+        if (script == NULL) {
+            printf("Move? ");
+        }
+    }
+    if (game->ready) {
+        line_fill(&humanInput);
+        game->ready = 0;
+    }
+    while (1) {
+        if (script != NULL) {
+            if (!script_line(script, line, sizeof(line))) {
+                fprintf(stderr, "End of input\n");
+                exit(7);
+            }
+        } else {
+            int status = line_take(&humanInput, line, sizeof(line));
+            if (status == 0) {
+                fflush(stdout);
+                game->wait = humanInput.fd;
+                return 0;
+            } else if (status < 0) {
+                fprintf(stderr, "End of input\n");
+                exit(7);
+            }
+        }
+        if (human_line(game, player, line)) {
+            game->started = 0;
+            return 1;
+        }
+        if (script == NULL) {
+            printf("Move? ");
+        }
+    }
+}
+
+/*Turns of the built in automated types, which never wait*/
+int bot_move(struct Game* game, int player) {
+    int side = player - 1;
+    auto_turn(game->types[side], player, game->hands[side], game->board, 
+            game->deck, &game->deckCount, &game->handCounts[side], 
+            &game->emptyCards, game->width, game->height, 
+            game->hands[1 - side], &params);
+    game->started = 0;
+    return 1;
+}
+
+/*Runs the BARK_ENGINE command for an 'e' player, returning NULL if there
+ * is none or it cannot be started*/
+struct Engine* start_engine(void) {
+    char* command = getenv("BARK_ENGINE");
+    int in[2], out[2];
+    if (command == NULL || pipe(in) != 0) {
+        return NULL;
+    }
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(in[i], F_SETFD, FD_CLOEXEC);
+        fcntl(out[i], F_SETFD, FD_CLOEXEC);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return NULL;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    struct Engine* engine = calloc(1, sizeof(struct Engine));
+    engine->pid = pid;
+    engine->to = in[1];
+    engine->from.fd = out[0];
+    return engine;
+}
+
+/*Closes an engine's pipes and waits for it to go*/
+void stop_engine(struct Engine* engine) {
+    if (engine != NULL) {
+        close(engine->to);
+        close(engine->from.fd);
+        waitpid(engine->pid, NULL, 0);
+        free(engine->pending);
+        free(engine);
+    }
+}
+
+/*Sends as much of an engine's pending text as its pipe will take. Returns
+ * 1 once it has all gone, 0 if the pipe is full and -1 if it cannot be 
+ * written.*/
+int engine_send(struct Engine* engine) {
+    while (engine->sent < engine->length) {
+        ssize_t wrote = write(engine->to, engine->pending + engine->sent, 
+                engine->length - engine->sent);
+        if (wrote < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrote < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (wrote <= 0) {
+            return -1;
+        }
+        engine->sent += wrote;
+    }
+    free(engine->pending);
+    engine->pending = NULL;
+    return 1;
+}
+
+/*External engine turns. Once the engine's card is dealt it is sent the 
+ * game as a savefile, with itself as the player to move, and the game 
+ * waits for its answer: a line with a card, column and row. A savefile 
+ * the pipe cannot take at once is sent as the pipe drains, the game 
+ * waiting for it to be writable in between, so other games go on. If the engine
+ * has gone or its move is not allowed the turn is played as an 'a' 
+ * player's, as are the rest of its turns. Sparse boards are always played
+ * that way, as their savefiles would be too big.*/
+int engine_move(struct Game* game, int player) {
+    int side = player - 1;
+    struct Engine* engine = game->engines[side];
+    char line[SCRIPT_LINE];
+    int card = 0, col = 0, row = 0;
+    if (engine == NULL || engine->failed || board_tiles(game->board) != NULL)
+    {
+        return bot_move(game, player);
+    }
+    if (!game->started) {
+        hand(game->deck, &game->deckCount, &game->handCounts[side], 
+                game->hands[side], &game->emptyCards);
+        print_hand(game->hands[side], player, 1);
+        engine->pending = malloc(save_size(game->board, game->width, 
+                game->height, game->deckName));
+        if (engine->pending == NULL) {
+            engine->failed = 1;
+            fprintf(stderr, "Player %d engine failed\n", player);
+            return bot_move(game, player);
+        }
+        engine->length = format_save(engine->pending, game->width, 
+                game->height, game->emptyCards, player, game->deckName, 
+                game->hands[0], game->hands[1], game->board);
+        engine->sent = 0;
+        game->started = 1;
+    }
+    if (engine->pending != NULL) {
+        int sent = engine_send(engine);
+        game->ready = 0;
+        if (sent == 0) {
+            game->wait = engine->to;
+            game->waitEvents = POLLOUT;
+            return 0;
+        } else if (sent < 0) {
+            engine->failed = 1;
+            fprintf(stderr, "Player %d engine failed\n", player);
+            return bot_move(game, player);
+        }
+    }
+    if (game->ready) {
+        line_fill(&engine->from);
+        game->ready = 0;
+    }
+    int status = line_take(&engine->from, line, sizeof(line));
+    if (status == 0) {
+        game->wait = engine->from.fd;
+        return 0;
+    }
+    if (status < 0 || sscanf(line, "%d %d %d", &card, &col, &row) != 3 || 
+            card < 1 || card > HAND_SIZE || 
+            game->hands[side][card - 1].number == 0 || col < 1 || 
+            col > game->width || row < 1 || row > game->height ||
+            !board_check(game->board, row, col, game->width, game->height)) {
+        engine->failed = 1;
+        fprintf(stderr, "Player %d engine failed\n", player);
+        return bot_move(game, player);
+    }
+    place_shuffle(game->hands[side], game->board, row, col, card, 
+            &game->handCounts[side]);
+    print_play(player, game->board, col, row);
+    draw_board(game->board, game->width, game->height);
+    game->started = 0;
+    return 1;
+}
+
+struct Player players[] = {
+    {'h', human_move},
+    {'a', bot_move},
+    {'g', bot_move},
+    {'s', bot_move},
+    {'e', engine_move}
+};
+
+/*Returns the Player for a type from PLAYER_TYPES*/
+struct Player* player_of(char type) {
+    for (int i = 0; i < (int)(sizeof(players) / sizeof(players[0])); i++) {
+        if (players[i].type == type) {
+            return &players[i];
+        }
+    }
+    return &players[1];
+}
+
+/*Plays games on this thread until they are all over. A game goes on as 
+ * long as its players can move; one waiting for input is skipped until 
+ * poll says the input has come, and when every game left is waiting the 
+ * thread sleeps in poll, so idle games cost nothing. A game may be 
+ * autosaved before each turn, and once it is over it is handed to finish
+ * to be scored.*/
+void run_games(struct Game* games, int count, void (*finish)(struct Game*)) 
+{
+    struct pollfd* polls = malloc(sizeof(struct pollfd) * count);
+    int* waiting = malloc(sizeof(int) * count);
+    int left = count;
+    while (left > 0) {
+        int moved = 0;
+        int waits = 0;
+        for (int g = 0; g < count; g++) {
+            struct Game* game = &games[g];
+            if (game->over) {
+                continue;
+            }
+            if (game->wait >= 0 && !game->ready) {
+                polls[waits].fd = game->wait;
+                polls[waits].events = game->waitEvents;
+                waiting[waits++] = g;
+                continue;
+            }
+            moved = 1;
+            if (!game->started && is_game_over(game->board, 
+                    &game->deckCount, &game->emptyCards, game->width, 
+                    game->height)) {
+                finish(game);
+                game->over = 1;
+                left--;
+                continue;
+            }
+            if (!game->started && game->autosave) {
+                autosave_turn(game->turn, game->deckName, game->hands[0], 
+                        game->hands[1], game->board, game->emptyCards, 
+                        game->width, game->height);
+            }
+            game->wait = -1;
+            game->waitEvents = POLLIN;
+            if (player_of(game->types[game->turn - 1])->move(game, 
+                    game->turn)) {
+                game->turn = 3 - game->turn;
+            }
+        }
+        if (waits > 0 && poll(polls, waits, moved ? 0 : -1) > 0) {
+            for (int i = 0; i < waits; i++) {
+                if (polls[i].revents != 0) {
+                    games[waiting[i]].ready = 1;
+                }
+            }
+        }
+    }
+    free(polls);
+    free(waiting);
+}
+
+/*Scores a game played by play_game, which exits*/
+void finish_game(struct Game* game) {
+    cal_score(game->board, game->width, game->height);
+    exit(0);
+}
+
+/*Play game plays a game set up by start_game or load_game, between player
+ * types p1 and p2 with player turn (1 or 2) to move, running it with 
+ * run_games until it is over, when it is scored and bark exits. An 'a' 
+ * against 'a' game whose outcome is cached is scored straight away (see
+ * recall_result).*/
 void play_game(char* p1, char* p2, char* deckName, struct Card* p1hand, 
         struct Card* p2hand, struct Card** board, struct Card* deck, 
         int* dCount, int* p1HandCount, int* p2HandCount, int* eCards, 
         int w, int h, int turn) {
-    while (is_game_over(board, dCount, eCards, w, h) == 0) {
-        if (*p1 == 'h' && *p2 == 'h') {
-            if (turn == 1) {
-                human_turn(1, p1hand, board, deck, dCount, p1HandCount, 
-                        eCards, w, h, deckName, p2hand);
-                human_turn(2, p2hand, board, deck, dCount, p2HandCount, 
-                        eCards, w, h, deckName, p1hand);
-            } else {
-                human_turn(2, p2hand, board, deck, dCount, p2HandCount, 
-                        eCards, w, h, deckName, p1hand);
-                human_turn(1, p1hand, board, deck, dCount, p1HandCount, 
-                        eCards, w, h, deckName, p2hand);
-            }
-        } else if (*p1 == 'h' && *p2 == 'a') {
-            if (turn == 1) {
-                human_turn(1, p1hand, board, deck, dCount, p1HandCount,
-                        eCards, w, h, deckName, p1hand);
-                ai(2, p2hand, board, deck, dCount, p2HandCount, eCards, w, h);
-            } else {
-                ai(2, p2hand, board, deck, dCount, p2HandCount, eCards, w, h);
-                human_turn(1, p1hand, board, deck, dCount, p1HandCount, eCards,
-                        w, h, deckName, p1hand);
-            }
-        } else if (*p1 == 'a' && *p2 == 'h') {
-            if (turn == 1) {
-                ai(1, p1hand, board, deck, dCount, p1HandCount, eCards, w, h);
-                human_turn(2, p2hand, board, deck, dCount, p2HandCount, 
-                        eCards, w, h, deckName, p1hand);
-            } else {
-                human_turn(2, p2hand, board, deck, dCount, p2HandCount, 
-                        eCards, w, h, deckName, p1hand);
-                ai(1, p1hand, board, deck, dCount, p1HandCount, eCards, w, h);
-            }
-        } else if (*p1 == 'a' && *p2 == 'a') {
-            if (turn == 1) {
-                ai(1, p1hand, board, deck, dCount, p1HandCount, eCards, w, h);
-                ai(2, p2hand, board, deck, dCount, p2HandCount, eCards, w, h);
-            } else {
-                ai(2, p2hand, board, deck, dCount, p2HandCount, eCards, w, h);
-                ai(1, p1hand, board, deck, dCount, p1HandCount, eCards, w, h); 
-            }
+    struct Game game;
+    recall_result(p1, p2, board, w, h, deck, *dCount, *eCards, p1hand, 
+            p2hand, turn);
+    memset(&game, 0, sizeof(game));
+    game.types[0] = *p1;
+    game.types[1] = *p2;
+    game.deckName = deckName;
+    game.hands[0] = p1hand;
+    game.hands[1] = p2hand;
+    game.handCounts[0] = *p1HandCount;
+    game.handCounts[1] = *p2HandCount;
+    game.board = board;
+    game.deck = deck;
+    game.deckCount = *dCount;
+    game.emptyCards = *eCards;
+    game.width = w;
+    game.height = h;
+    game.turn = turn;
+    game.wait = -1;
+    game.autosave = 1;
+    for (int side = 0; side < 2; side++) {
+        if (game.types[side] == 'e' && 
+                (game.engines[side] = start_engine()) == NULL) {
+            fprintf(stderr, "Unable to start engine\n");
+            exit(2);
         }
     }
+    run_games(&game, 1, finish_game);
 }
 
 /*Used when loading a game, the function adds given cards to a given hand,
@@ -647,7 +2288,7 @@ void add_cards(struct Card* hand, char* cards, int* handCount) {
     int counter = 0;
     for (int i = 0; i < size; i++) {
         char suit = cards[i + 1];
-        int number = cards[i] - '0';
+        int number = RANK_VALUE(cards[i]);
         if (isalpha(suit) == 0) {
             printf("Unable to load");
             exit(3);
@@ -662,21 +2303,23 @@ void add_cards(struct Card* hand, char* cards, int* handCount) {
 
 /*Load board initializes a given board (in the form of strings),
  * adding cards to the board in the correct location or entering 0 cards
- * into the boards spaces. Checks if the board given is full and exits
- * accordingly. */
+ * into the boards spaces. load_game then plays any delta records on it 
+ * and checks whether it is full.*/
 void load_board(FILE* load, int height, int width, struct Card** board) {
-    char* card = malloc(sizeof(char) * 20);
+    char* card = NULL;
     for (int i = 1; i < height + 1; i++) {
         int counter = 1;
         char* row = read_line(load);
+        card = realloc(card, sizeof(char) * (strlen(row) + width * 2 + 2));
+        memset(card, 0, strlen(row) + width * 2 + 2);
         sscanf(row, "%s", card);
         if (*card == EOF) {
             fprintf(stdout, "Unable to parse load file");
         }
         for (int j = 0; j < width * 2; j++) {
             if (card[j] != '*' && card[j + 1] != '*') {
-                board[counter][i].number = card[j] - '0';
-                board[counter][i].suit = card[j + 1];
+                struct Card loaded = {card[j + 1], RANK_VALUE(card[j]), 1};
+                place_card(board, counter, i, loaded);
                 counter++;
             } else {
                 counter++;
@@ -684,11 +2327,6 @@ void load_board(FILE* load, int height, int width, struct Card** board) {
             j++;
         }
     }
-    draw_board(board, width, height);
-    if (is_board_full(board, width, height)) {
-        fprintf(stderr, "Board full");
-        exit(6);
-    }
 }
 
 /*If Up checks all the possible spaces above a given row and col
@@ -945,8 +2583,25 @@ int recursive(char suit, int steps, int col, int row, int w, int h,
     return final;
 }
 
-/*Prints the highest score from each persons valid hands.*/
+/*Prints (and publishes) the final scores and ends the game*/
+void report_score(int p1, int p2) {
+    struct Event event = new_event(EVENT_SCORE, 0);
+    event.p1 = p1;
+    event.p2 = p2;
+    publish_event(&event);
+    store_result(p1, p2);
+    fprintf(stdout, "Player 1=%d Player 2=%d\n", p1, p2);
+    exit(0);
+}
+
+/*Prints the highest score from each persons valid hands. Sparse boards 
+ * are scored from their tiles.*/
 void print_score(struct Card** board, int width, int height) {
+    if (board_tiles(board) != NULL) {
+        int p1, p2;
+        best_scores(board, width, height, NULL, 0, &p1, &p2);
+        report_score(p1, p2);
+    }
     struct Card* p1Score = malloc(sizeof(struct Card) * (width * height));
     struct Card* p2Score = malloc(sizeof(struct Card) * (width * height));
     int p1Counter = 0;
@@ -956,7 +2611,7 @@ void print_score(struct Card** board, int width, int height) {
     for (int i = 1; i < height + 1; i++) {
         for (int j = 1; j < width + 1; j++) {
             if (board[j][i].number != 0) {
-                if (board[j][i].suit % 2 == 1) {
+                if (PLAYER_OF(board[j][i].suit) == 1) {
                     p1Score[p1Counter].score = board[j][i].score;
                     p1Counter++;
                 } else {
@@ -976,16 +2631,33 @@ void print_score(struct Card** board, int width, int height) {
             p2 = p2Score[i].score;
         }
     }
-    fprintf(stdout, "Player 1=%d Player 2=%d\n", p1, p2);
-    exit(0);
+    report_score(p1, p2);
 }
 
 
 /*Calculates the score of each card by checking all cards around itself,
  * then using a recusrive function checks their cards around them, etc.
  * they then return the highest path and from that 4 are returned. From
- * those 4 the highest will be set to the struct Card scord.*/
+ * those 4 the highest will be set to the struct Card scord. The if_ 
+ * functions only know the wrapping board, so other boards are scored with
+ * path_score. Big boards are scored by parallel_scores instead.*/
 void cal_score(struct Card** board, int w, int h) {
+    if (board_tiles(board) != NULL || (long)w * h >= SCORE_PARALLEL_CELLS) {
+        int p1, p2;
+        parallel_scores(board, w, h, &p1, &p2);
+        report_score(p1, p2);
+    }
+    if (!TORUS) {
+        for (int i = 1; i < h + 1; i++) {
+            for (int j = 1; j < w + 1; j++) {
+                if (board[j][i].number != 0) {
+                    board[j][i].score = path_score(board, w, h, j, i, 
+                            board[j][i].suit, 1);
+                }
+            }
+        }
+        print_score(board, w, h);
+    }
     for (int i = 1; i < h + 1; i++) {
         for (int j = 1; j < w + 1; j++) {
             int c = corner_check(board, i, j, w, h, 1);
@@ -1033,69 +2705,3860 @@ void cal_score(struct Card** board, int w, int h) {
     print_score(board, w, h);
 }
 
-/*Loads the game from a given file by reading each line and returning 
- * it as a string, and basis player types on an input.
- * Once the loaded game is over, it will call the cal_score function
- * and return the scores of the game.*/
-void load_game(char* argv[]) { 
-    struct Card* p1Hand = malloc(sizeof(struct Card) * 6);
-    struct Card* p2Hand = malloc(sizeof(struct Card) * 6);
-    int p1HandCount = 0;
-    int p2HandCount = 0;
-    int deckCount = 0;
-    int width, height, emptyCards, turn;
-    FILE* load = fopen(argv[1], "r");
-    char* deckName = malloc(sizeof(char) * 20);
-    int lineNo = 2;
-    code_check(argv[2], argv[3], 3, 3);
-    if (load == NULL) {
-        fprintf(stderr, "Unable to parse savefile\n");
-        exit(4);
+/*Wraps a 1 based board co-ordinate around the edges of the board, the same
+ * way the if_up/if_down/if_left/if_right functions treat the board as a 
+ * torus. On boards that do not wrap, co-ordinates off the board become 0,
+ * as row and column 0 are always empty.*/
+int wrap(int value, int size) {
+    if (!TORUS) {
+        return (value < 1 || value > size) ? 0 : value;
     }
-    char* firstLine = read_line(load);
-    sscanf(firstLine, "%d %d %d %d", &width, &height, &emptyCards, &turn);
-    struct Card** board = create_board(width, height);
-    struct Card* fullDeck = malloc(sizeof(struct Card) * deckCount);
-    code_check(argv[2], argv[3], width, height);
-    while (1) {
-        char* temp = read_line(load);
-        if (lineNo == 2) {
-            sscanf(temp, "%s", deckName);
-            if (deckName[strlen(deckName) - 1] == '/') {
-                fprintf(stderr, "Unable to parse deckfile\n");
-                exit(3);
+    return ((value - 1 + size) % size) + 1;
+}
+
+/*Checks if a card may be placed at col and row, without the corner and side
+ * cases: the cell must be empty and at least one of the four cells around it
+ * (wrapping around the edges) must hold a card. Does not handle the empty 
+ * board, where any cell is legal.*/
+int is_legal(struct Card** board, int width, int height, int row, int col) {
+    if (board_cell(board, col, row)->number != 0) {
+        return 0;
+    }
+    return board_cell(board, wrap(col - 1, width), row)->number != 0 || 
+            board_cell(board, wrap(col + 1, width), row)->number != 0 || 
+            board_cell(board, col, wrap(row - 1, height))->number != 0 || 
+            board_cell(board, col, wrap(row + 1, height))->number != 0;
+}
+
+/*Orders cells from the top left, for qsort*/
+int compare_cells(const void* a, const void* b) {
+    long first = *(const long*)a;
+    long second = *(const long*)b;
+    return (first > second) - (first < second);
+}
+
+/*Lists the cells a card may be placed on from the top left, as 
+ * (row - 1) * width + col - 1, setting count. On an empty board only the
+ * center is listed. Sparse boards only look next to their cards.*/
+long* legal_cells(struct Card** board, int w, int h, long* count) {
+    struct Tiles* tiles = board_tiles(board);
+    long* cells;
+    *count = 0;
+    if (tiles != NULL) {
+        long position = 0;
+        int col, row;
+        cells = malloc(sizeof(long) * (tiles->cards * 4 + 1));
+        while (next_card(tiles, board, &position, &col, &row)) {
+            int cols[4] = {col, col, wrap(col + 1, w), wrap(col - 1, w)};
+            int rows[4] = {wrap(row - 1, h), wrap(row + 1, h), row, row};
+            for (int i = 0; i < 4; i++) {
+                if (cols[i] != 0 && rows[i] != 0 && 
+                        board_cell(board, cols[i], rows[i])->number == 0) {
+                    cells[(*count)++] = (long)(rows[i] - 1) * w + cols[i] - 1;
+                }
+            }
+        }
+        qsort(cells, *count, sizeof(long), compare_cells);
+        long kept = 0;
+        for (long i = 0; i < *count; i++) {
+            if (kept == 0 || cells[i] != cells[kept - 1]) {
+                cells[kept++] = cells[i];
             }
-            fullDeck = init_deck(deckName, &deckCount);
-            lineNo++;
-        } else if (lineNo == 3) {
-            char* temps = malloc(sizeof(char) * 20);
-            sscanf(temp, "%s", temps);
-            add_cards(p1Hand, temps, &p1HandCount);    
-            lineNo++;
-        } else if (lineNo == 4) {
-            char* temps = malloc(sizeof(char) * 20);
-            sscanf(temp, "%s", temps);
-            add_cards(p2Hand, temps, &p2HandCount);
-            lineNo++;
-            load_board(load, height, width, board);
-            play_game(argv[2], argv[3], deckName, p1Hand, p2Hand, board, 
-                    fullDeck, &deckCount, &p1HandCount, &p2HandCount, 
-                    &emptyCards, width, height, turn);
         }
+        *count = kept;
+    } else {
+        cells = malloc(sizeof(long) * (w * h + 1));
+        for (int i = 1; i < h + 1; i++) {
+            for (int j = 1; j < w + 1; j++) {
+                if (is_legal(board, w, h, i, j)) {
+                    cells[(*count)++] = (long)(i - 1) * w + j - 1;
+                }
+            }
+        }
+    }
+    if (*count == 0) {
+        cells[(*count)++] = (long)((h + 1) / 2 - 1) * w + (w + 1) / 2 - 1;
+    }
+    return cells;
+}
 
+/*Returns the cells next to board's cards, working them out with 
+ * legal_cells the first time. From then on place_card keeps them up to 
+ * date through frontier_place, so 'a' and 'g' turns never scan the board.*/
+struct Frontier* frontier_state(struct Card** board, int w, int h) {
+    struct Frontier* frontier = board_frontier(board);
+    if (frontier != NULL) {
+        return frontier;
     }
-    if(is_game_over(board, &deckCount, &emptyCards, width, height)) { 
-        cal_score(board, width, height);
+    frontier = calloc(1, sizeof(struct Frontier));
+    frontier->width = w;
+    frontier->height = h;
+    frontier->cells = legal_cells(board, w, h, &frontier->count);
+    frontier->space = frontier->count;
+    if (frontier->count == 1 && !is_legal(board, w, h, 
+            frontier->cells[0] / w + 1, frontier->cells[0] % w + 1)) {
+        frontier->count = 0;
     }
+    board[-3] = (struct Card*)(void*)frontier;
+    return frontier;
 }
 
-/*Starts a new game given paramaters and player types. If the game ends 
- * cal_score is called and the scores are printed and the game ends.*/
-void start_game(char* argv[]) {
-    int deckCount = 0;
-    int emptyCards = 0;
-    struct Card** board;
-    int p1HandCount = 0;
+/*Brings a board's Frontier up to date with a card being placed at col and
+ * row (still empty): the cell stops being a place to play, while the empty
+ * cells around it that had no card next to them become ones*/
+void frontier_place(struct Frontier* frontier, struct Card** board, int col,
+        int row) {
+    int w = frontier->width;
+    int h = frontier->height;
+    long cell = (long)(row - 1) * w + col - 1;
+    long added[4];
+    int addedCount = 0;
+    for (long i = 0; i < frontier->count; i++) {
+        if (frontier->cells[i] == cell) {
+            frontier->cells[i] = frontier->cells[--frontier->count];
+            break;
+        }
+    }
+    int cols[4] = {col, col, wrap(col + 1, w), wrap(col - 1, w)};
+    int rows[4] = {wrap(row - 1, h), wrap(row + 1, h), row, row};
+    for (int i = 0; i < 4; i++) {
+        long next = (long)(rows[i] - 1) * w + cols[i] - 1;
+        int fresh = (cols[i] != 0 && rows[i] != 0 && next != cell &&
+                !is_legal(board, w, h, rows[i], cols[i]) && 
+                board_cell(board, cols[i], rows[i])->number == 0);
+        for (int j = 0; j < addedCount && fresh; j++) {
+            fresh = (added[j] != next);
+        }
+        if (!fresh) {
+            continue;
+        }
+        if (frontier->count == frontier->space) {
+            frontier->space = (frontier->space < 16) ? 16 : 
+                    frontier->space * 2;
+            frontier->cells = realloc(frontier->cells, sizeof(long) * 
+                    frontier->space);
+        }
+        frontier->cells[frontier->count++] = next;
+        added[addedCount++] = next;
+    }
+}
+
+/*Follows the same paths as recursive without allocating: every path goes to
+ * a strictly higher neighbouring card and the longest path ending on a card
+ * of the starting suit is returned (at least 1 for the starting card).*/
+int path_score(struct Card** board, int w, int h, int col, int row, 
+        char suit, int steps) {
+    struct Card* card = board_cell(board, col, row);
+    int number = card->number;
+    int best = (card->suit == suit) ? steps : 0;
+    int cols[4] = {col, col, wrap(col + 1, w), wrap(col - 1, w)};
+    int rows[4] = {wrap(row - 1, h), wrap(row + 1, h), row, row};
+    for (int i = 0; i < 4; i++) {
+        if (board_cell(board, cols[i], rows[i])->number > number) {
+            int score = path_score(board, w, h, cols[i], rows[i], suit, 
+                    steps + 1);
+            best = (score > best) ? score : best;
+        }
+    }
+    return best;
+}
+
+/*Works out the same totals as print_score (the highest card score of each
+ * player, split by PLAYER_OF) without printing or exiting. Only the cells 
+ * listed in cells are looked at when cells is not NULL.*/
+void best_scores(struct Card** board, int w, int h, int* cells, int count, 
+        int* p1, int* p2) {
+    struct Tiles* tiles = board_tiles(board);
+    *p1 = 0;
+    *p2 = 0;
+    if (cells == NULL && tiles != NULL) {
+        long position = 0;
+        int col, row;
+        while (next_card(tiles, board, &position, &col, &row)) {
+            char suit = board_cell(board, col, row)->suit;
+            int score = path_score(board, w, h, col, row, suit, 1);
+            if (PLAYER_OF(suit) == 1) {
+                *p1 = (score > *p1) ? score : *p1;
+            } else {
+                *p2 = (score > *p2) ? score : *p2;
+            }
+        }
+        return;
+    }
+    int total = (cells == NULL) ? w * h : count;
+    for (int i = 0; i < total; i++) {
+        int cell = (cells == NULL) ? i : cells[i];
+        int col = cell % w + 1;
+        int row = cell / w + 1;
+        struct Card* card = board_cell(board, col, row);
+        if (card->number == 0) {
+            continue;
+        }
+        int score = path_score(board, w, h, col, row, card->suit, 1);
+        if (PLAYER_OF(card->suit) == 1) {
+            *p1 = (score > *p1) ? score : *p1;
+        } else {
+            *p2 = (score > *p2) ? score : *p2;
+        }
+    }
+}
+
+/*Shared state of parallel_scores. Every tile of a dense board, or every
+ * tile of a sparse one that has been written to, is in tiles, and slots 
+ * (or for a sparse board, its index) gives the place in tiles (plus one) 
+ * of a tile number. For the tile in place i, order 
+ * holds the offsets of its cards sorted by rank, those of rank r starting
+ * at starts[i * (RANK_LIMIT + 2) + r], and lengths holds, for each of its
+ * cells and each suit on the board, the longest increasing path from the
+ * cell that ends on a card of that suit (0 if there is none). suits maps a
+ * suit to its place in lengths. next counts the tiles handed out at each 
+ * level. threads is the number of threads that got started, 0 until they 
+ * all have been; the barrier is only set up then, so the threads wait on 
+ * ready before they start.*/
+struct Wavefront {
+    struct Card** board;
+    int width;
+    int height;
+    int across;
+    int* tiles;
+    int count;
+    int* slots;
+    struct Tiles* index;
+    short* order;
+    int* starts;
+    unsigned char* lengths;
+    char present[256];
+    int suits[256];
+    int suitCount;
+    int next[RANK_LIMIT + 2];
+    int threads;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_barrier_t barrier;
+};
+
+/*One parallel_scores thread and the best scores of the cards it scored*/
+struct WaveJob {
+    struct Wavefront* wave;
+    int p1;
+    int p2;
+};
+
+/*Hands out the next tile to work on at level, or -1 once all have been*/
+int take_tile(struct Wavefront* wave, int level) {
+    int slot = __atomic_fetch_add(&wave->next[level], 1, __ATOMIC_RELAXED);
+    return (slot < wave->count) ? slot : -1;
+}
+
+/*Sorts the cards of the tile in slot by rank and notes their suits*/
+void sort_tile(struct Wavefront* wave, int slot) {
+    int tile = wave->tiles[slot];
+    int left = tile % wave->across * TILE_SIZE + 1;
+    int top = tile / wave->across * TILE_SIZE + 1;
+    int* starts = wave->starts + (size_t)slot * (RANK_LIMIT + 2);
+    short* order = wave->order + (size_t)slot * TILE_SIZE * TILE_SIZE;
+    memset(starts, 0, sizeof(int) * (RANK_LIMIT + 2));
+    for (int offset = 0; offset < TILE_SIZE * TILE_SIZE; offset++) {
+        int col = left + offset % TILE_SIZE;
+        int row = top + offset / TILE_SIZE;
+        struct Card* card = board_cell(wave->board, col, row);
+        if (col <= wave->width && row <= wave->height && card->number != 0) {
+            starts[card->number + 1]++;
+            __atomic_store_n(&wave->present[(unsigned char)card->suit], 1, 
+                    __ATOMIC_RELAXED);
+        }
+    }
+    for (int rank = 1; rank < RANK_LIMIT + 2; rank++) {
+        starts[rank] += starts[rank - 1];
+    }
+    int filled[RANK_LIMIT + 1];
+    memcpy(filled, starts, sizeof(filled));
+    for (int offset = 0; offset < TILE_SIZE * TILE_SIZE; offset++) {
+        int col = left + offset % TILE_SIZE;
+        int row = top + offset / TILE_SIZE;
+        struct Card* card = board_cell(wave->board, col, row);
+        if (col <= wave->width && row <= wave->height && card->number != 0) {
+            order[filled[card->number]++] = offset;
+        }
+    }
+}
+
+/*The path lengths of the cell at col and row*/
+unsigned char* cell_lengths(struct Wavefront* wave, int col, int row) {
+    int tile = (row - 1) / TILE_SIZE * wave->across + (col - 1) / TILE_SIZE;
+    int offset = (row - 1) % TILE_SIZE * TILE_SIZE + (col - 1) % TILE_SIZE;
+    int slot = (wave->index != NULL) ? tile_slot(wave->index, tile) : 
+            wave->slots[tile];
+    return wave->lengths + ((size_t)(slot - 1) * TILE_SIZE * TILE_SIZE + 
+            offset) * wave->suitCount;
+}
+
+/*Scores the cards of rank in the tile in slot. Paths only go up in rank,
+ * so the cards around them that they can step to have all been done at 
+ * earlier levels, those over the tile's edge included.*/
+void score_level(struct Wavefront* wave, int slot, int rank, 
+        struct WaveJob* job) {
+    int tile = wave->tiles[slot];
+    int left = tile % wave->across * TILE_SIZE + 1;
+    int top = tile / wave->across * TILE_SIZE + 1;
+    int* starts = wave->starts + (size_t)slot * (RANK_LIMIT + 2);
+    short* order = wave->order + (size_t)slot * TILE_SIZE * TILE_SIZE;
+    for (int i = starts[rank]; i < starts[rank + 1]; i++) {
+        int col = left + order[i] % TILE_SIZE;
+        int row = top + order[i] / TILE_SIZE;
+        struct Card* card = board_cell(wave->board, col, row);
+        unsigned char* out = cell_lengths(wave, col, row);
+        int own = wave->suits[(unsigned char)card->suit];
+        memset(out, 0, wave->suitCount);
+        out[own] = 1;
+        int cols[4] = {col, col, wrap(col + 1, wave->width), 
+                wrap(col - 1, wave->width)};
+        int rows[4] = {wrap(row - 1, wave->height), 
+                wrap(row + 1, wave->height), row, row};
+        for (int n = 0; n < 4; n++) {
+            if (board_cell(wave->board, cols[n], rows[n])->number <= rank) {
+                continue;
+            }
+            unsigned char* in = cell_lengths(wave, cols[n], rows[n]);
+            for (int s = 0; s < wave->suitCount; s++) {
+                if (in[s] != 0 && in[s] + 1 > out[s]) {
+                    out[s] = in[s] + 1;
+                }
+            }
+        }
+        card->score = out[own];
+        if (PLAYER_OF(card->suit) == 1) {
+            job->p1 = (card->score > job->p1) ? card->score : job->p1;
+        } else {
+            job->p2 = (card->score > job->p2) ? card->score : job->p2;
+        }
+    }
+}
+
+/*Thread body for parallel_scores. Each thread takes tiles until there are
+ * none left at a level, then waits for the others: first to sort every 
+ * tile's cards, then for each rank from the top down to score that rank's 
+ * cards.*/
+void* wavefront_thread(void* data) {
+    struct WaveJob* job = data;
+    struct Wavefront* wave = job->wave;
+    int slot;
+    pthread_mutex_lock(&wave->lock);
+    while (wave->threads == 0) {
+        pthread_cond_wait(&wave->ready, &wave->lock);
+    }
+    pthread_mutex_unlock(&wave->lock);
+    while ((slot = take_tile(wave, 0)) >= 0) {
+        sort_tile(wave, slot);
+    }
+    if (pthread_barrier_wait(&wave->barrier) == 
+            PTHREAD_BARRIER_SERIAL_THREAD) {
+        for (int suit = 0; suit < 256; suit++) {
+            if (wave->present[suit]) {
+                wave->suits[suit] = wave->suitCount++;
+            }
+        }
+        wave->lengths = malloc((size_t)wave->count * TILE_SIZE * TILE_SIZE *
+                (wave->suitCount + 1));
+    }
+    pthread_barrier_wait(&wave->barrier);
+    for (int rank = TOP_RANK; rank > 0; rank--) {
+        while ((slot = take_tile(wave, rank)) >= 0) {
+            score_level(wave, slot, rank, job);
+        }
+        pthread_barrier_wait(&wave->barrier);
+    }
+    return NULL;
+}
+
+/*Scores every card on the board, setting each card's score and p1 and p2
+ * to the totals print_score would give, with the work spread over threads.
+ * A card's score only depends on the higher cards next to it, so the 
+ * cards are scored a rank at a time from the top, as a wavefront: within 
+ * a rank the board's tiles are shared out between the threads, which wait
+ * for each other before the next rank. Each cell's path lengths for every
+ * suit are kept so the cards below can build on them, and cells over a 
+ * tile's edge are read from the next tile's lengths, which are finished 
+ * by then.*/
+void parallel_scores(struct Card** board, int w, int h, int* p1, int* p2) {
+    struct Tiles* tiles = board_tiles(board);
+    struct Wavefront wave;
+    char* setting = getenv("BARK_SCORE_THREADS");
+    int threads = (setting != NULL && atoi(setting) > 0) ? atoi(setting) : 
+            (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int down = (h + TILE_SIZE - 1) / TILE_SIZE;
+    memset(&wave, 0, sizeof(wave));
+    wave.board = board;
+    wave.width = w;
+    wave.height = h;
+    wave.across = (w + TILE_SIZE - 1) / TILE_SIZE;
+    if (tiles != NULL) {
+        wave.count = tiles->count;
+        wave.tiles = malloc(sizeof(int) * (tiles->count + 1));
+        memcpy(wave.tiles, tiles->list, sizeof(int) * tiles->count);
+        wave.index = tiles;
+    } else {
+        wave.count = wave.across * down;
+        wave.tiles = malloc(sizeof(int) * wave.count);
+        wave.slots = malloc(sizeof(int) * wave.count);
+        for (int i = 0; i < wave.count; i++) {
+            wave.tiles[i] = i;
+            wave.slots[i] = i + 1;
+        }
+    }
+    wave.order = malloc(sizeof(short) * TILE_SIZE * TILE_SIZE * 
+            (wave.count + 1));
+    wave.starts = malloc(sizeof(int) * (RANK_LIMIT + 2) * (wave.count + 1));
+    threads = (threads > wave.count) ? wave.count : threads;
+    threads = (threads < 1) ? 1 : threads;
+    struct WaveJob* jobs = calloc(threads, sizeof(struct WaveJob));
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    int started = 1;
+    pthread_mutex_init(&wave.lock, NULL);
+    pthread_cond_init(&wave.ready, NULL);
+    jobs[0].wave = &wave;
+    while (started < threads) {
+        jobs[started].wave = &wave;
+        if (pthread_create(&ids[started], NULL, wavefront_thread, 
+                &jobs[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+    pthread_barrier_init(&wave.barrier, NULL, started);
+    pthread_mutex_lock(&wave.lock);
+    wave.threads = started;
+    pthread_cond_broadcast(&wave.ready);
+    pthread_mutex_unlock(&wave.lock);
+    wavefront_thread(&jobs[0]);
+    *p1 = 0;
+    *p2 = 0;
+    for (int t = 0; t < started; t++) {
+        if (t > 0) {
+            pthread_join(ids[t], NULL);
+        }
+        *p1 = (jobs[t].p1 > *p1) ? jobs[t].p1 : *p1;
+        *p2 = (jobs[t].p2 > *p2) ? jobs[t].p2 : *p2;
+    }
+    pthread_barrier_destroy(&wave.barrier);
+    pthread_cond_destroy(&wave.ready);
+    pthread_mutex_destroy(&wave.lock);
+    free(wave.tiles);
+    free(wave.slots);
+    free(wave.order);
+    free(wave.starts);
+    free(wave.lengths);
+    free(jobs);
+    free(ids);
+}
+
+/*Works out both players' best scores if card were placed at col and row,
+ * without rescoring the board. Only cards with an increasing path into the
+ * new card can score differently, so those are found by walking out from 
+ * it to lower neighbours and only they are rescored; every other card keeps
+ * its old score, already counted in p1 and p2. seen (one int per cell) and
+ * stamp stop cells being visited twice without clearing seen each time. 
+ * Sparse boards pass NULL for seen and the stamp goes in the cards' score
+ * instead, which only cal_score fills in at the end of the game.*/
+void placement_scores(struct Card** board, int w, int h, int col, int row,
+        struct Card card, int* seen, int stamp, long* stack, int* p1, 
+        int* p2) {
+    int top = 0;
+    struct Card* placed = board_slot(board, col, row);
+    *placed = card;
+    stack[top++] = (long)(row - 1) * w + col - 1;
+    if (seen != NULL) {
+        seen[stack[0]] = stamp;
+    } else {
+        placed->score = -stamp;
+    }
+    while (top > 0) {
+        long cell = stack[--top];
+        int c = cell % w + 1;
+        int r = cell / w + 1;
+        struct Card* here = board_cell(board, c, r);
+        int score = path_score(board, w, h, c, r, here->suit, 1);
+        if (PLAYER_OF(here->suit) == 1) {
+            *p1 = (score > *p1) ? score : *p1;
+        } else {
+            *p2 = (score > *p2) ? score : *p2;
+        }
+        int cols[4] = {c, c, wrap(c + 1, w), wrap(c - 1, w)};
+        int rows[4] = {wrap(r - 1, h), wrap(r + 1, h), r, r};
+        for (int i = 0; i < 4; i++) {
+            long next = (long)(rows[i] - 1) * w + cols[i] - 1;
+            struct Card* neighbour = board_cell(board, cols[i], rows[i]);
+            if (neighbour->number == 0 || neighbour->number >= here->number) {
+                continue;
+            }
+            if (seen != NULL && seen[next] != stamp) {
+                seen[next] = stamp;
+                stack[top++] = next;
+            } else if (seen == NULL && neighbour->score != -stamp) {
+                neighbour->score = -stamp;
+                stack[top++] = next;
+            }
+        }
+    }
+    placed->number = 0;
+    placed->suit = 0;
+    placed->score = 1;
+}
+
+/*Mixes a 64 bit value (splitmix64), used to build the board and hand keys
+ * of the solver's transposition table.*/
+uint64_t mix_key(uint64_t value) {
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+/*Key of a single card at a given place (a board cell, or a hand slot when
+ * cell is negative)*/
+uint64_t card_key(int cell, struct Card card) {
+    return mix_key(((uint64_t)(cell + 2) << 16) | 
+            ((uint64_t)card.number << 8) | (unsigned char)card.suit);
+}
+
+/*Translation invariant key of the cards on a board, kept up to date as 
+ * cards are placed and lifted. Every card adds a key of its own and every
+ * pair of cards adds pair_key of the two cards and the offset between them
+ * (both ways round, wrapping around the torus), so boards that are shifted
+ * copies of each other get the same key in whatever order their cards went
+ * down. views holds the part of the key each card is in; the card with the
+ * smallest view is the anchor that moves are stored relative to, and 
+ * shifted boards pick the same card. Boards that do not wrap key each card
+ * on its cell as well, so only the same board matches.*/
+struct Canon {
+    int width;
+    int height;
+    int count;
+    uint64_t key;
+    uint64_t* views;
+    int* cells;
+    int* slots;
+};
+
+/*Key of card to going with card from, col and row cells right and down of
+ * it*/
+uint64_t pair_key(struct Card from, struct Card to, int col, int row) {
+    return mix_key(((uint64_t)(unsigned char)from.suit << 56) | 
+            ((uint64_t)from.number << 48) | 
+            ((uint64_t)(unsigned char)to.suit << 40) | 
+            ((uint64_t)to.number << 32) | ((uint64_t)col << 16) | 
+            (uint64_t)row);
+}
+
+/*The pair keys between the card at cell and the card at other, which is
+ * what either adds to the other's view*/
+uint64_t canon_pair(struct Canon* canon, struct Card** board, int cell, 
+        int other) {
+    int w = canon->width;
+    int h = canon->height;
+    int col = cell % w;
+    int row = cell / w;
+    int c = other % w;
+    int r = other / w;
+    struct Card card = board[col + 1][row + 1];
+    struct Card card2 = board[c + 1][r + 1];
+    return pair_key(card, card2, (c - col + w) % w, (r - row + h) % h) + 
+            pair_key(card2, card, (col - c + w) % w, (row - r + h) % h);
+}
+
+/*Adds the card just placed at col and row to the key*/
+void canon_add(struct Canon* canon, struct Card** board, int col, int row) {
+    int cell = (row - 1) * canon->width + col - 1;
+    uint64_t view = card_key(TORUS ? -2 : cell, board[col][row]);
+    for (int i = 0; i < canon->count; i++) {
+        uint64_t pair = canon_pair(canon, board, cell, canon->cells[i]);
+        canon->views[canon->cells[i]] += pair;
+        view += pair;
+    }
+    canon->views[cell] = view;
+    canon->slots[cell] = canon->count;
+    canon->cells[canon->count++] = cell;
+    canon->key += view;
+}
+
+/*Takes the card at col and row out of the key, before it is lifted*/
+void canon_remove(struct Canon* canon, struct Card** board, int col, 
+        int row) {
+    int cell = (row - 1) * canon->width + col - 1;
+    int last = canon->cells[--canon->count];
+    canon->cells[canon->slots[cell]] = last;
+    canon->slots[last] = canon->slots[cell];
+    canon->key -= canon->views[cell];
+    for (int i = 0; i < canon->count; i++) {
+        canon->views[canon->cells[i]] -= canon_pair(canon, board, cell, 
+                canon->cells[i]);
+    }
+}
+
+/*Sets canon up with the cards already on the board*/
+void canon_init(struct Canon* canon, struct Card** board, int w, int h) {
+    canon->width = w;
+    canon->height = h;
+    canon->count = 0;
+    canon->key = 0;
+    canon->views = malloc(sizeof(uint64_t) * w * h);
+    canon->cells = malloc(sizeof(int) * w * h);
+    canon->slots = malloc(sizeof(int) * w * h);
+    for (int i = 1; i < h + 1; i++) {
+        for (int j = 1; j < w + 1; j++) {
+            if (board[j][i].number != 0) {
+                canon_add(canon, board, j, i);
+            }
+        }
+    }
+}
+
+/*Finds the anchor card (the center on an empty board)*/
+void canon_anchor(struct Canon* canon, int* anchorCol, int* anchorRow) {
+    int best = -1;
+    *anchorCol = (canon->width + 1) / 2;
+    *anchorRow = (canon->height + 1) / 2;
+    for (int i = 0; i < canon->count; i++) {
+        int cell = canon->cells[i];
+        if (best < 0 || canon->views[cell] < canon->views[best]) {
+            best = cell;
+        }
+    }
+    if (best >= 0) {
+        *anchorCol = best % canon->width + 1;
+        *anchorRow = best / canon->width + 1;
+    }
+}
+
+/*Frees what canon_init allocated*/
+void canon_free(struct Canon* canon) {
+    free(canon->views);
+    free(canon->cells);
+    free(canon->slots);
+}
+
+/*The time and node allowance of one automated move. Searches call 
+ * budget_expired from their inner loops and stop once it returns 1. When
+ * stop is set the search also ends as soon as another thread sets *stop.
+ * The clock is read when nodes & clockMask is 0, so searches whose nodes 
+ * are expensive can read it every time.*/
+struct Budget {
+    struct timespec start;
+    struct timespec deadline;
+    long nodes;
+    long maxNodes;
+    long clockMask;
+    int expired;
+    int* stop;
+};
+
+/*Returns the number of milliseconds a move is allowed, read from 
+ * BARK_MOVE_MS when set*/
+int move_ms(void) {
+    char* value = getenv("BARK_MOVE_MS");
+    return (value != NULL && atoi(value) > 0) ? atoi(value) : MOVE_MS;
+}
+
+/*Returns the number of search nodes a move is allowed (0 for no limit), 
+ * read from BARK_MOVE_NODES when set*/
+long move_nodes(void) {
+    char* value = getenv("BARK_MOVE_NODES");
+    return (value != NULL && atol(value) >= 0) ? atol(value) : MOVE_NODES;
+}
+
+/*Starts a move's allowance from now. Searches are stopped at 90% of the
+ * time allowed, leaving the rest for unwinding and playing the move.*/
+void budget_start(struct Budget* budget) {
+    long us = move_ms() * 900L;
+    budget->nodes = 0;
+    budget->maxNodes = move_nodes();
+    budget->clockMask = 15;
+    budget->expired = 0;
+    budget->stop = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &budget->start);
+    budget->deadline = budget->start;
+    budget->deadline.tv_sec += us / 1000000;
+    budget->deadline.tv_nsec += (us % 1000000) * 1000;
+    if (budget->deadline.tv_nsec >= 1000000000) {
+        budget->deadline.tv_sec++;
+        budget->deadline.tv_nsec -= 1000000000;
+    }
+}
+
+/*Counts a node and returns 1 once the node limit is reached or the 
+ * deadline has passed. The clock is only read every 16 nodes unless the
+ * search lowered clockMask.*/
+int budget_expired(struct Budget* budget) {
+    if (budget->expired) {
+        return 1;
+    }
+    budget->nodes++;
+    if (budget->maxNodes > 0 && budget->nodes >= budget->maxNodes) {
+        budget->expired = 1;
+    } else if ((budget->nodes & budget->clockMask) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((budget->stop != NULL && 
+                __atomic_load_n(budget->stop, __ATOMIC_RELAXED)) ||
+                now.tv_sec > budget->deadline.tv_sec || 
+                (now.tv_sec == budget->deadline.tv_sec && 
+                now.tv_nsec >= budget->deadline.tv_nsec)) {
+            budget->expired = 1;
+        }
+    }
+    return budget->expired;
+}
+
+/*Counts us microseconds already spent on the move elsewhere against the 
+ * budget, bringing its deadline forward*/
+void budget_credit(struct Budget* budget, long us) {
+    budget->start.tv_sec -= us / 1000000;
+    budget->start.tv_nsec -= (us % 1000000) * 1000;
+    budget->deadline.tv_sec -= us / 1000000;
+    budget->deadline.tv_nsec -= (us % 1000000) * 1000;
+    if (budget->start.tv_nsec < 0) {
+        budget->start.tv_sec--;
+        budget->start.tv_nsec += 1000000000;
+    }
+    if (budget->deadline.tv_nsec < 0) {
+        budget->deadline.tv_sec--;
+        budget->deadline.tv_nsec += 1000000000;
+    }
+}
+
+/*Microseconds since the budget was started*/
+long budget_elapsed(struct Budget* budget) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - budget->start.tv_sec) * 1000000L + 
+            (now.tv_nsec - budget->start.tv_nsec) / 1000;
+}
+
+/*A placement: card is the 1 based hand index used by place_shuffle*/
+struct Move {
+    int card;
+    int col;
+    int row;
+};
+
+/*One remembered search result, keyed on the board, both hands and the 
+ * number of cards left. flag says whether value is exact or a bound, and 
+ * depth how many turns ahead it looked; a shallower result is only used to
+ * try its move first.*/
+struct Entry {
+    uint64_t key;
+    int value;
+    int flag;
+    int depth;
+    struct Move move;
+};
+
+/*Layout of a position cache file: a header followed by slots (a power of
+ * two) in buckets of CACHE_BUCKET. A key goes in the bucket picked by its
+ * low bits. Other processes write to the file at the same time, so each 
+ * result is packed into data and check holds key ^ data: a slot half 
+ * written by someone else does not check out and is treated as empty.*/
+struct CacheHeader {
+    char magic[8];
+    uint32_t slots;
+    uint32_t unused;
+};
+
+struct CacheEntry {
+    uint64_t check;
+    uint64_t data;
+};
+
+/*The position cache 's' players share, opened once by whichever thread 
+ * needs it first. header is NULL when BARK_CACHE is not set.*/
+struct Cache {
+    struct CacheHeader* header;
+    struct CacheEntry* entries;
+};
+
+struct Cache cache;
+pthread_once_t cacheOnce = PTHREAD_ONCE_INIT;
+
+/*Maps (creating when needed) the cache file named by BARK_CACHE, shared
+ * and writable*/
+void cache_open_default(void) {
+    char* file = getenv("BARK_CACHE");
+    size_t size = sizeof(struct CacheHeader) + 
+            sizeof(struct CacheEntry) * CACHE_SLOTS;
+    struct stat info;
+    cache.header = NULL;
+    if (file == NULL) {
+        return;
+    }
+    int fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &info) != 0 || ((size_t)info.st_size < size && 
+            ftruncate(fd, size) != 0)) {
+        close(fd);
+        return;
+    }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 
+            0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    struct CacheHeader* header = data;
+    if (header->slots == 0) {
+        memcpy(header->magic, CACHE_MAGIC, 8);
+        header->slots = CACHE_SLOTS;
+    }
+    if (memcmp(header->magic, CACHE_MAGIC, 8) != 0 || 
+            header->slots != CACHE_SLOTS) {
+        munmap(data, size);
+        return;
+    }
+    cache.entries = (struct CacheEntry*)(header + 1);
+    cache.header = header;
+}
+
+/*Looks key up, filling in data and returning 1 if it is there*/
+int cache_find(uint64_t key, uint64_t* data) {
+    struct CacheEntry* bucket = &cache.entries[key & (CACHE_SLOTS - 1) & 
+            ~(uint64_t)(CACHE_BUCKET - 1)];
+    for (int i = 0; i < CACHE_BUCKET; i++) {
+        uint64_t check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+        uint64_t value = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+        if ((check ^ value) == key) {
+            *data = value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*Stores data for key over the same key, or else over the slot holding the
+ * shallowest result in the bucket (empty slots first)*/
+void cache_store(uint64_t key, uint64_t data) {
+    struct CacheEntry* bucket = &cache.entries[key & (CACHE_SLOTS - 1) & 
+            ~(uint64_t)(CACHE_BUCKET - 1)];
+    int slot = 0;
+    int shallowest = 256;
+    for (int i = 0; i < CACHE_BUCKET; i++) {
+        uint64_t check = __atomic_load_n(&bucket[i].check, __ATOMIC_RELAXED);
+        uint64_t value = __atomic_load_n(&bucket[i].data, __ATOMIC_RELAXED);
+        int depth = (check == 0 && value == 0) ? -1 : 
+                (int)((value >> 40) & 0xFF);
+        if ((check ^ value) == key) {
+            slot = i;
+            break;
+        }
+        if (depth < shallowest) {
+            shallowest = depth;
+            slot = i;
+        }
+    }
+    __atomic_store_n(&bucket[slot].data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket[slot].check, key ^ data, __ATOMIC_RELAXED);
+}
+
+/*Games between two 'a' players are decided by the position they start 
+ * from, so their outcomes are kept in the position cache as well, under 
+ * game_key. resultKey is the key of the game being played, or 0 when its
+ * outcome is not to be kept.*/
+uint64_t resultKey = 0;
+
+/*Key of the position a game starts from: the board size and its cards, 
+ * both hands in order, the deck cards still to be dealt in order, who 
+ * moves first and (in variant builds) the rules*/
+uint64_t game_key(struct Card** board, int w, int h, struct Card* deck, 
+        int deckCount, int emptyCards, struct Card* p1Hand, 
+        struct Card* p2Hand, int turn) {
+    uint64_t key = mix_key(((uint64_t)w << 40) | ((uint64_t)h << 20) | 
+            ((uint64_t)deckCount << 2) | turn);
+    for (int i = 1; i < h + 1; i++) {
+        for (int j = 1; j < w + 1; j++) {
+            if (board[j][i].number != 0) {
+                key ^= card_key((i - 1) * w + j - 1, board[j][i]);
+            }
+        }
+    }
+    for (int i = 0; i < HAND_SIZE; i++) {
+        if (p1Hand[i].number != 0) {
+            key += card_key(-1 - i, p1Hand[i]);
+        }
+        if (p2Hand[i].number != 0) {
+            key += card_key(-1 - HAND_LIMIT - i, p2Hand[i]);
+        }
+    }
+    for (int i = emptyCards; i < deckCount; i++) {
+        key += card_key(-1 - 2 * HAND_LIMIT - i, deck[i]);
+    }
+#ifdef BARK_VARIANTS
+    key ^= mix_key(((uint64_t)rules.handSize << 32) | 
+            ((uint64_t)rules.topRank << 8) | rules.torus);
+    for (int i = 0; rules.p1Suits[i] != '\0'; i++) {
+        key += mix_key(rules.p1Suits[i]);
+    }
+#endif
+    return (key == 0) ? 1 : key;
+}
+
+/*Called as a game starts. If both players are 'a' and the position 
+ * cache (BARK_CACHE) knows how the game ends, the final score is reported
+ * straight away without playing it; otherwise the game's key is kept for
+ * store_result. Sparse boards are always played.*/
+void recall_result(char* p1, char* p2, struct Card** board, int w, int h, 
+        struct Card* deck, int deckCount, int emptyCards, 
+        struct Card* p1Hand, struct Card* p2Hand, int turn) {
+    uint64_t data;
+    if (*p1 != 'a' || *p2 != 'a' || board_tiles(board) != NULL) {
+        return;
+    }
+    pthread_once(&cacheOnce, cache_open_default);
+    if (cache.header == NULL) {
+        return;
+    }
+    resultKey = game_key(board, w, h, deck, deckCount, emptyCards, p1Hand, 
+            p2Hand, turn);
+    if (cache_find(resultKey, &data)) {
+        resultKey = 0;
+        report_score((int)(data & 0xFFFF), (int)((data >> 16) & 0xFFFF));
+    }
+}
+
+/*Keeps the outcome of the game recall_result looked up. It is stored as
+ * deep as a cache entry can be, so solver results are replaced first.*/
+void store_result(int p1, int p2) {
+    if (resultKey != 0) {
+        cache_store(resultKey, (uint64_t)p1 | ((uint64_t)p2 << 16) | 
+                (0xFFULL << 40));
+        resultKey = 0;
+    }
+}
+
+/*Everything the solver needs while searching. Cards are placed on and
+ * lifted off the real board, and both players' best scores (p1, p2) are
+ * kept up to date with placement_scores so a leaf is scored for free. The
+ * empty cells next to cards (frontier, with where giving each cell's place
+ * in it or -1 and near counting the cards around it) are kept up to date 
+ * the same way, so moves are listed without scanning the board. Each ply
+ * lists its moves into its own stack (plies, grown as needed).*/
+struct Solver {
+    struct Card** board;
+    int width;
+    int height;
+    struct Card* deck;
+    int deckCount;
+    int next;
+    int limit;
+    struct Card hands[2][HAND_LIMIT];
+    int handCounts[2];
+    int cellCount;
+    int p1;
+    int p2;
+    int* seen;
+    long* stack;
+    int stamp;
+    int* near;
+    long* where;
+    long* frontier;
+    long frontierCount;
+    long* order;
+    struct Move** plies;
+    long* plySpace;
+    int ply;
+    int plyCount;
+    uint64_t boardKey;
+    struct Entry* table;
+    struct Budget budget;
+    int cached;
+    struct Canon canon;
+};
+
+/*Returns the deck size at which 's' players start solving, read from
+ * BARK_ENDGAME when set*/
+int endgame_cards(void) {
+    char* value = getenv("BARK_ENDGAME");
+    return (value != NULL && atoi(value) >= 0) ? atoi(value) : ENDGAME_CARDS;
+}
+
+/*Key of the whole position: board, both hands, cards left and whose turn.
+ * Hand cards are added rather than xored so a pair of equal cards does not
+ * cancel out.*/
+uint64_t solver_key(struct Solver* solver, int side) {
+    uint64_t key = solver->boardKey ^ mix_key(solver->next * 2 + side);
+    for (int p = 0; p < 2; p++) {
+        for (int i = 0; i < solver->handCounts[p]; i++) {
+            key += card_key(-1 - p, solver->hands[p][i]);
+        }
+    }
+    return key;
+}
+
+/*Key of the position in the shared cache: the board up to translation, 
+ * the board size, whose turn, both hands, how many turns are searched and
+ * the deck cards that will be drawn in them*/
+uint64_t cache_key(struct Solver* solver, int side, int depth) {
+    int left = solver->deckCount - solver->next;
+    uint64_t key = solver->canon.key ^ mix_key(((uint64_t)solver->width << 
+            44) | ((uint64_t)solver->height << 24) | ((uint64_t)depth << 10) |
+            ((uint64_t)((left < depth) ? left : depth + 1) << 1) | side);
+    for (int p = 0; p < 2; p++) {
+        for (int i = 0; i < solver->handCounts[p]; i++) {
+            key += card_key(-1 - p, solver->hands[p][i]);
+        }
+    }
+    for (int i = 0; i < depth && i < left; i++) {
+        key += card_key(-3 - i, solver->deck[solver->next + i]);
+    }
+    return (key == 0) ? 1 : key;
+}
+
+/*Packs a search result for the shared cache: the move's offset from the 
+ * anchor in bits 0-11 (column) and 12-23 (row), the value (plus 32768) in
+ * 24-39, the depth in 40-47, the flag in 48-49 and the card's number and 
+ * suit in 50-55 and 56-63*/
+uint64_t cache_pack(struct Solver* solver, int side, struct Entry* entry, 
+        int anchorCol, int anchorRow) {
+    struct Card card = solver->hands[side][entry->move.card - 1];
+    uint64_t col = (entry->move.col - anchorCol + solver->width) % 
+            solver->width;
+    uint64_t row = (entry->move.row - anchorRow + solver->height) % 
+            solver->height;
+    return col | (row << 12) | ((uint64_t)(entry->value + 32768) << 24) |
+            ((uint64_t)(entry->depth & 0xFF) << 40) | 
+            ((uint64_t)entry->flag << 48) | ((uint64_t)card.number << 50) |
+            ((uint64_t)(unsigned char)card.suit << 56);
+}
+
+/*Unpacks a cached result into entry, finding the card in side's hand. 
+ * Returns 0 if the card is not in the hand or the move is not legal here, 
+ * which means two positions shared a key.*/
+int cache_unpack(struct Solver* solver, int side, uint64_t data, 
+        int anchorCol, int anchorRow, struct Entry* entry) {
+    int number = (data >> 50) & 0x3F;
+    char suit = (char)(data >> 56);
+    entry->value = (int)((data >> 24) & 0xFFFF) - 32768;
+    entry->depth = (data >> 40) & 0xFF;
+    entry->flag = (data >> 48) & 3;
+    entry->move.card = 0;
+    entry->move.col = (anchorCol - 1 + (int)(data & 0xFFF)) % solver->width 
+            + 1;
+    entry->move.row = (anchorRow - 1 + (int)((data >> 12) & 0xFFF)) % 
+            solver->height + 1;
+    for (int i = 0; i < solver->handCounts[side]; i++) {
+        if (solver->hands[side][i].number == number && 
+                solver->hands[side][i].suit == suit) {
+            entry->move.card = i + 1;
+            break;
+        }
+    }
+    if (entry->move.card == 0 || entry->flag == 0) {
+        return 0;
+    }
+    if (solver->cellCount == 0) {
+        return entry->move.col == anchorCol && entry->move.row == anchorRow;
+    }
+    return is_legal(solver->board, solver->width, solver->height, 
+            entry->move.row, entry->move.col);
+}
+
+/*Lists the legal placements for the given hand on the current ply's move
+ * stack, skipping repeated cards in the hand since they lead to the same 
+ * position. Cells come from the frontier, sorted so they are listed from 
+ * the top left. On an empty board only the center is listed, as every cell
+ * of the torus is the same there. Sets count and returns the moves, or 
+ * returns NULL with count 0 (and the budget expired, so the search ends) if
+ * the stack could not be grown.*/
+struct Move* solver_moves(struct Solver* solver, int side, int* count) {
+    struct Card* theHand = solver->hands[side];
+    long cells = solver->frontierCount;
+    long center = (long)((solver->height + 1) / 2 - 1) * solver->width + 
+            (solver->width + 1) / 2 - 1;
+    *count = 0;
+    if (solver->cellCount == 0) {
+        cells = 1;
+        solver->order[0] = center;
+    } else {
+        memcpy(solver->order, solver->frontier, sizeof(long) * cells);
+        qsort(solver->order, cells, sizeof(long), compare_cells);
+    }
+    if (solver->plies == NULL || solver->ply >= solver->plyCount) {
+        solver->budget.expired = 1;
+        return NULL;
+    }
+    long needed = solver->handCounts[side] * cells + 1;
+    if (solver->plySpace[solver->ply] < needed) {
+        struct Move* grown = realloc(solver->plies[solver->ply], 
+                sizeof(struct Move) * needed);
+        if (grown == NULL) {
+            solver->budget.expired = 1;
+            return NULL;
+        }
+        solver->plies[solver->ply] = grown;
+        solver->plySpace[solver->ply] = needed;
+    }
+    struct Move* moves = solver->plies[solver->ply];
+    for (int card = 0; card < solver->handCounts[side]; card++) {
+        int repeat = 0;
+        for (int i = 0; i < card; i++) {
+            if (theHand[i].number == theHand[card].number && 
+                    theHand[i].suit == theHand[card].suit) {
+                repeat = 1;
+            }
+        }
+        if (repeat) {
+            continue;
+        }
+        for (long i = 0; i < cells; i++) {
+            moves[*count].card = card + 1;
+            moves[*count].col = solver->order[i] % solver->width + 1;
+            moves[*count].row = solver->order[i] / solver->width + 1;
+            (*count)++;
+        }
+    }
+    return moves;
+}
+
+/*Adds cell to the solver's frontier unless it is there already*/
+void solver_add_cell(struct Solver* solver, long cell) {
+    if (solver->where[cell] < 0) {
+        solver->where[cell] = solver->frontierCount;
+        solver->frontier[solver->frontierCount++] = cell;
+    }
+}
+
+/*Takes cell out of the solver's frontier if it is there*/
+void solver_remove_cell(struct Solver* solver, long cell) {
+    long at = solver->where[cell];
+    if (at >= 0) {
+        long last = solver->frontier[--solver->frontierCount];
+        solver->frontier[at] = last;
+        solver->where[last] = at;
+        solver->where[cell] = -1;
+    }
+}
+
+/*Counts the card at col and row (change 1) or its removal (change -1) in
+ * the cards next to each of its neighbours, bringing the frontier up to 
+ * date. The cell itself must already hold the card, or be empty again.*/
+void solver_neighbours(struct Solver* solver, int col, int row, int change) {
+    int w = solver->width;
+    int h = solver->height;
+    int cols[4] = {col, col, wrap(col + 1, w), wrap(col - 1, w)};
+    int rows[4] = {wrap(row - 1, h), wrap(row + 1, h), row, row};
+    long cell = (long)(row - 1) * w + col - 1;
+    if (change > 0) {
+        solver_remove_cell(solver, cell);
+    }
+    for (int i = 0; i < 4; i++) {
+        if (cols[i] == 0 || rows[i] == 0) {
+            continue;
+        }
+        long next = (long)(rows[i] - 1) * w + cols[i] - 1;
+        solver->near[next] += change;
+        if (solver->board[cols[i]][rows[i]].number != 0) {
+            continue;
+        }
+        if (solver->near[next] > 0) {
+            solver_add_cell(solver, next);
+        } else {
+            solver_remove_cell(solver, next);
+        }
+    }
+    if (change < 0 && solver->near[cell] > 0) {
+        solver_add_cell(solver, cell);
+    }
+}
+
+/*What solver_apply changed, so solver_revert can put it back*/
+struct Undo {
+    struct Card hand[HAND_LIMIT];
+    int handCount;
+    struct Card card;
+    int cell;
+    int over;
+    int drew;
+    int p1;
+    int p2;
+};
+
+/*Places move for side and, unless that ended the game, deals the next deck
+ * card to the other side, as hand() does at the start of their turn (only
+ * if their hand has room, so the deck only moves on when a card is 
+ * dealt).*/
+void solver_apply(struct Solver* solver, int side, struct Move move, 
+        struct Undo* undo) {
+    struct Card* theHand = solver->hands[side];
+    int other = 1 - side;
+    memcpy(undo->hand, theHand, sizeof(undo->hand));
+    undo->handCount = solver->handCounts[side];
+    undo->cell = (move.row - 1) * solver->width + move.col - 1;
+    undo->card = theHand[move.card - 1];
+    for (int i = move.card - 1; i < undo->handCount - 1; i++) {
+        theHand[i] = theHand[i + 1];
+    }
+    solver->handCounts[side]--;
+    undo->p1 = solver->p1;
+    undo->p2 = solver->p2;
+    placement_scores(solver->board, solver->width, solver->height, move.col,
+            move.row, undo->card, solver->seen, ++solver->stamp, 
+            solver->stack, &solver->p1, &solver->p2);
+    solver->board[move.col][move.row] = undo->card;
+    solver_neighbours(solver, move.col, move.row, 1);
+    solver->ply++;
+    solver->cellCount++;
+    solver->boardKey ^= card_key(undo->cell, undo->card);
+    if (solver->cached) {
+        canon_add(&solver->canon, solver->board, move.col, move.row);
+    }
+    undo->over = solver->next == solver->deckCount || 
+            solver->cellCount == solver->width * solver->height;
+    undo->drew = 0;
+    if (!undo->over && solver->handCounts[other] < HAND_SIZE) {
+        solver->hands[other][solver->handCounts[other]++] = 
+                solver->deck[solver->next++];
+        undo->drew = 1;
+    }
+}
+
+/*Takes back a move made with solver_apply*/
+void solver_revert(struct Solver* solver, int side, struct Move move, 
+        struct Undo* undo) {
+    if (undo->drew) {
+        solver->next--;
+        solver->handCounts[1 - side]--;
+    }
+    solver->boardKey ^= card_key(undo->cell, undo->card);
+    if (solver->cached) {
+        canon_remove(&solver->canon, solver->board, move.col, move.row);
+    }
+    solver->cellCount--;
+    solver->p1 = undo->p1;
+    solver->p2 = undo->p2;
+    solver->board[move.col][move.row].number = 0;
+    solver->board[move.col][move.row].suit = 0;
+    solver->board[move.col][move.row].score = 1;
+    solver_neighbours(solver, move.col, move.row, -1);
+    solver->ply--;
+    memcpy(solver->hands[side], undo->hand, sizeof(undo->hand));
+    solver->handCounts[side] = undo->handCount;
+}
+
+int solver_search(struct Solver* solver, int side, int alpha, int beta, 
+        struct Move* best);
+
+/*Plays a move for side, searches the rest of the game (or up to the
+ * solver's limit) for the other side and takes the move back, returning the
+ * value for side.*/
+int solver_try(struct Solver* solver, int side, struct Move move, int alpha,
+        int beta) {
+    struct Undo undo;
+    int value;
+    solver_apply(solver, side, move, &undo);
+    if (undo.over || solver->next >= solver->limit) {
+        value = (side == 0) ? solver->p1 - solver->p2 : 
+                solver->p2 - solver->p1;
+    } else {
+        struct Move reply;
+        value = -solver_search(solver, 1 - side, -beta, -alpha, &reply);
+    }
+    solver_revert(solver, side, move, &undo);
+    return value;
+}
+
+/*Alpha-beta (negamax) search over every placement of every card until the
+ * deck runs out or the solver's limit is reached, scoring boards the way 
+ * cal_score does. side 0 is player 1. Results are remembered in the table
+ * so positions reached in a different order are only searched once.*/
+int solver_search(struct Solver* solver, int side, int alpha, int beta, 
+        struct Move* best) {
+    uint64_t key = solver_key(solver, side);
+    struct Entry* entry = &solver->table[key & (SOLVER_TABLE_SIZE - 1)];
+    int startAlpha = alpha;
+    int depth = ((solver->limit < solver->deckCount + 1) ? solver->limit : 
+            solver->deckCount + 1) - solver->next;
+    struct Move first = {0, 0, 0};
+    if (entry->key == key && entry->flag != 0) {
+        first = entry->move;
+    }
+    if (entry->key == key && entry->depth == depth) {
+        if (entry->flag == 1 || (entry->flag == 2 && entry->value >= beta) ||
+                (entry->flag == 3 && entry->value <= alpha)) {
+            *best = entry->move;
+            return entry->value;
+        }
+    }
+    uint64_t shared = 0;
+    int anchorCol, anchorRow;
+    if (solver->cached && depth >= CACHE_DEPTH) {
+        struct Entry hit;
+        uint64_t data;
+        shared = cache_key(solver, side, depth);
+        canon_anchor(&solver->canon, &anchorCol, &anchorRow);
+        if (cache_find(shared, &data) && cache_unpack(solver, side, data, 
+                anchorCol, anchorRow, &hit)) {
+            if (hit.flag == 1 || (hit.flag == 2 && hit.value >= beta) ||
+                    (hit.flag == 3 && hit.value <= alpha)) {
+                *best = hit.move;
+                return hit.value;
+            }
+            first = (first.card == 0) ? hit.move : first;
+        }
+    }
+    int count;
+    struct Move* moves = solver_moves(solver, side, &count);
+    int value = -1000;
+    best->card = 0;
+    if (count == 0) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (first.card != 0 && moves[i].card == first.card && 
+                moves[i].col == first.col && moves[i].row == first.row) {
+            moves[i] = moves[0];
+            moves[0] = first;
+        }
+    }
+    for (int i = 0; i < count && !budget_expired(&solver->budget); i++) {
+        int score = solver_try(solver, side, moves[i], alpha, beta);
+        if (solver->budget.expired) {
+            break;
+        }
+        if (score > value) {
+            value = score;
+            *best = moves[i];
+        }
+        alpha = (score > alpha) ? score : alpha;
+        if (alpha >= beta) {
+            break;
+        }
+    }
+    if (best->card == 0) {
+        *best = moves[0];
+    }
+    if (!solver->budget.expired) {
+        entry->key = key;
+        entry->depth = depth;
+        entry->value = value;
+        entry->move = *best;
+        entry->flag = (value <= startAlpha) ? 3 : (value >= beta) ? 2 : 1;
+        if (shared != 0) {
+            cache_store(shared, cache_pack(solver, side, entry, anchorCol, 
+                    anchorRow));
+        }
+    }
+    return value;
+}
+
+/*Sets up a solver for player (1 or 2) holding theHand, with the opponent
+ * holding opHand and the deck dealt up to emptyCards. The move's budget 
+ * starts now and the search looks to the end of the game unless limit is 
+ * lowered.*/
+void solver_init(struct Solver* solver, int player, struct Card* theHand, 
+        struct Card* opHand, struct Card** board, struct Card* deck, 
+        int deckCount, int emptyCards, int width, int height) {
+    int side = player - 1;
+    solver->board = board;
+    solver->width = width;
+    solver->height = height;
+    solver->deck = deck;
+    solver->deckCount = deckCount;
+    solver->next = emptyCards;
+    solver->limit = deckCount + 1;
+    solver->handCounts[0] = solver->handCounts[1] = 0;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        if (theHand[i].number != 0) {
+            solver->hands[side][solver->handCounts[side]++] = theHand[i];
+        }
+        if (opHand[i].number != 0) {
+            solver->hands[1 - side][solver->handCounts[1 - side]++] = 
+                    opHand[i];
+        }
+    }
+    solver->cellCount = 0;
+    solver->boardKey = 0;
+    solver->near = calloc(width * height, sizeof(int));
+    solver->where = malloc(sizeof(long) * width * height);
+    solver->frontier = malloc(sizeof(long) * width * height);
+    solver->order = malloc(sizeof(long) * width * height);
+    solver->frontierCount = 0;
+    for (int i = 1; i < height + 1; i++) {
+        for (int j = 1; j < width + 1; j++) {
+            solver->where[(i - 1) * width + j - 1] = -1;
+        }
+    }
+    for (int i = 1; i < height + 1; i++) {
+        for (int j = 1; j < width + 1; j++) {
+            if (board[j][i].number != 0) {
+                solver->cellCount++;
+                solver->boardKey ^= card_key((i - 1) * width + j - 1, 
+                        board[j][i]);
+                solver_neighbours(solver, j, i, 1);
+            }
+        }
+    }
+    solver->ply = 0;
+    solver->plyCount = deckCount - emptyCards + 2 * HAND_LIMIT + 1;
+    solver->plies = calloc(solver->plyCount, sizeof(struct Move*));
+    solver->plySpace = calloc(solver->plyCount, sizeof(long));
+    if (solver->plySpace == NULL) {
+        free(solver->plies);
+        solver->plies = NULL;
+    }
+    best_scores(board, width, height, NULL, 0, &solver->p1, &solver->p2);
+    solver->seen = calloc(width * height, sizeof(int));
+    solver->stack = malloc(sizeof(long) * width * height);
+    solver->stamp = 0;
+    solver->table = calloc(SOLVER_TABLE_SIZE, sizeof(struct Entry));
+    pthread_once(&cacheOnce, cache_open_default);
+    solver->cached = cache.header != NULL && width <= 4096 && height <= 4096;
+    if (solver->cached) {
+        canon_init(&solver->canon, board, width, height);
+    }
+    budget_start(&solver->budget);
+}
+
+/*Frees what solver_init allocated*/
+void solver_free(struct Solver* solver) {
+    if (solver->cached) {
+        canon_free(&solver->canon);
+    }
+    free(solver->table);
+    free(solver->seen);
+    free(solver->stack);
+    free(solver->near);
+    free(solver->where);
+    free(solver->frontier);
+    free(solver->order);
+    for (int i = 0; i < solver->plyCount && solver->plies != NULL; i++) {
+        free(solver->plies[i]);
+    }
+    free(solver->plies);
+    free(solver->plySpace);
+}
+
+/*Swaps table (when there is one) in for the solver's own and counts 
+ * credit microseconds against its budget, for a search picking up where 
+ * pondering left off*/
+void solver_resume(struct Solver* solver, struct Entry* table, long credit) {
+    if (table != NULL) {
+        free(solver->table);
+        solver->table = table;
+    }
+    budget_credit(&solver->budget, credit);
+}
+
+/*Finds the best placement for player (1 or 2) holding theHand, with the 
+ * remaining deck cards and the opponents hand known, searching to the end of
+ * the game. The returned move is proven optimal unless the time allowed runs
+ * out, in which case the best move fully searched so far is returned.
+ * value is set to the final score difference from the player's view. 
+ * table and credit come from ponder_finish (NULL and 0 for none).*/
+struct Move endgame_solve(int player, struct Card* theHand, struct Card* 
+        opHand, struct Card** board, struct Card* deck, int deckCount, 
+        int emptyCards, int width, int height, int* value, 
+        struct Entry* table, long credit) {
+    struct Solver solver;
+    struct Move best = {1, (width + 1) / 2, (height + 1) / 2};
+    solver_init(&solver, player, theHand, opHand, board, deck, deckCount, 
+            emptyCards, width, height);
+    solver_resume(&solver, table, credit);
+    *value = solver_search(&solver, player - 1, -1000, 1000, &best);
+    if (best.card == 0) {
+        best.card = 1;
+    }
+    solver_free(&solver);
+    return best;
+}
+
+/*Iterative deepening for 's' players: searches one turn ahead, then two,
+ * and so on, keeping the move of the deepest search that finished. The
+ * table carries each search's best moves into the next so they are tried
+ * first. Stops when the budget runs out (the unfinished search is thrown
+ * away) or a search reaches the end of the game. table and credit are as
+ * for endgame_solve.*/
+struct Move deepen_search(int player, struct Card* theHand, struct Card* 
+        opHand, struct Card** board, struct Card* deck, int deckCount, 
+        int emptyCards, int width, int height, int* reached, 
+        struct Entry* table, long credit) {
+    struct Solver solver;
+    struct Move best = {0, 0, 0};
+    struct Move found;
+    solver_init(&solver, player, theHand, opHand, board, deck, deckCount, 
+            emptyCards, width, height);
+    solver_resume(&solver, table, credit);
+    *reached = 0;
+    for (int depth = 1; solver.next + depth <= deckCount + 1; depth++) {
+        solver.limit = solver.next + depth;
+        solver_search(&solver, player - 1, -1000, 1000, &found);
+        if (solver.budget.expired || found.card == 0) {
+            break;
+        }
+        best = found;
+        *reached = depth;
+    }
+    if (best.card == 0) {
+        int count;
+        struct Move* moves = solver_moves(&solver, player - 1, &count);
+        if (count > 0) {
+            best = moves[0];
+        }
+    }
+    solver_free(&solver);
+    return best;
+}
+
+/*A move the human might make while an 's' player ponders: the card and
+ * where it goes, how good it looks straight away from the human's view 
+ * (guess), the deepest finished search of the position it leads to (root,
+ * flag 0 if none) and the microseconds spent on that position*/
+struct Reply {
+    struct Move move;
+    struct Card card;
+    int guess;
+    struct Entry root;
+    long spent;
+};
+
+/*An 's' player pondering while a human thinks about their move. The thread
+ * works on copies of the board and deck, with the human's hand (opHand) 
+ * already holding the card hand() is about to deal them, and searches the
+ * position each reply leads to one turn deeper at a time, likeliest 
+ * replies first. Setting stop ends it; its table then goes to the search 
+ * of the 's' player's move.*/
+struct Ponder {
+    pthread_t thread;
+    int running;
+    int stop;
+    int player;
+    struct Card theHand[HAND_LIMIT];
+    struct Card opHand[HAND_LIMIT];
+    struct Card** board;
+    struct Card* deck;
+    int deckCount;
+    int emptyCards;
+    int width;
+    int height;
+    struct Reply* replies;
+    int count;
+    struct Entry* table;
+};
+
+struct Ponder ponder;
+
+/*Orders replies best looking (for the human) first*/
+int compare_replies(const void* a, const void* b) {
+    return ((struct Reply*)b)->guess - ((struct Reply*)a)->guess;
+}
+
+/*Body of the pondering thread. Its budget has no node limit or deadline 
+ * that matters, only the stop flag.*/
+void* ponder_thread(void* data) {
+    struct Ponder* ponder = data;
+    struct Solver solver;
+    int side = 2 - ponder->player;
+    solver_init(&solver, 3 - ponder->player, ponder->opHand, ponder->theHand,
+            ponder->board, ponder->deck, ponder->deckCount, 
+            ponder->emptyCards, ponder->width, ponder->height);
+    solver.budget.maxNodes = 0;
+    solver.budget.deadline.tv_sec += 86400;
+    solver.budget.stop = &ponder->stop;
+    int count;
+    struct Move* moves = solver_moves(&solver, side, &count);
+    ponder->replies = calloc(count + 1, sizeof(struct Reply));
+    for (int i = 0; i < count; i++) {
+        struct Undo undo;
+        ponder->replies[i].move = moves[i];
+        ponder->replies[i].card = solver.hands[side][moves[i].card - 1];
+        solver_apply(&solver, side, moves[i], &undo);
+        ponder->replies[i].guess = (side == 0) ? solver.p1 - solver.p2 : 
+                solver.p2 - solver.p1;
+        solver_revert(&solver, side, moves[i], &undo);
+    }
+    qsort(ponder->replies, count, sizeof(struct Reply), compare_replies);
+    ponder->count = count;
+    int searched = 1;
+    for (int depth = 1; searched && !solver.budget.expired; depth++) {
+        searched = 0;
+        for (int i = 0; i < count && !solver.budget.expired; i++) {
+            struct Reply* reply = &ponder->replies[i];
+            struct Undo undo;
+            struct Move found;
+            long start = budget_elapsed(&solver.budget);
+            solver_apply(&solver, side, reply->move, &undo);
+            if (!undo.over && solver.next + depth <= solver.deckCount + 1) {
+                solver.limit = solver.next + depth;
+                int value = solver_search(&solver, 1 - side, -1000, 1000, 
+                        &found);
+                if (!solver.budget.expired && found.card != 0) {
+                    reply->root.key = solver_key(&solver, 1 - side);
+                    reply->root.value = value;
+                    reply->root.flag = 1;
+                    reply->root.depth = depth;
+                    reply->root.move = found;
+                }
+                searched = 1;
+            }
+            solver_revert(&solver, side, reply->move, &undo);
+            reply->spent += budget_elapsed(&solver.budget) - start;
+        }
+    }
+    ponder->table = solver.table;
+    solver.table = NULL;
+    solver_free(&solver);
+    return NULL;
+}
+
+/*Stops pondering and returns its table (NULL if nothing was pondering) for
+ * the caller to pass on and free. When the human's move now on board is 
+ * one of the replies searched to some depth, that result is put back in 
+ * the table and credit is set to the time pondering spent on it, so the 
+ * search of this position costs no more in total than one move's budget.
+ * Otherwise credit is 0 and only the table's other results are of use.*/
+struct Entry* ponder_finish(struct Card** board, long* credit) {
+    *credit = 0;
+    if (!ponder.running) {
+        return NULL;
+    }
+    __atomic_store_n(&ponder.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(ponder.thread, NULL);
+    ponder.running = 0;
+    for (int i = 0; i < ponder.count; i++) {
+        struct Reply* reply = &ponder.replies[i];
+        struct Card card = board[reply->move.col][reply->move.row];
+        if (ponder.board[reply->move.col][reply->move.row].number == 0 &&
+                card.number == reply->card.number && 
+                card.suit == reply->card.suit) {
+            if (reply->root.flag != 0) {
+                ponder.table[reply->root.key & (SOLVER_TABLE_SIZE - 1)] = 
+                        reply->root;
+                *credit = reply->spent;
+            }
+            break;
+        }
+    }
+    free_board(ponder.board, ponder.width);
+    free(ponder.deck);
+    free(ponder.replies);
+    return ponder.table;
+}
+
+/*Starts player, of the given type and holding theHand (handCount cards), 
+ * pondering while the other player, a human holding opHand (opCount 
+ * cards), makes their move. Only 's' players ponder, and not on sparse 
+ * boards, at the end of the game or with BARK_PONDER set to 0. Anything 
+ * still pondering from before is thrown away.*/
+void ponder_start(char type, int player, struct Card* theHand, int handCount,
+        struct Card* opHand, int opCount, struct Card** board, 
+        struct Card* deck, int deckCount, int emptyCards, int width, 
+        int height) {
+    char* value = getenv("BARK_PONDER");
+    long credit;
+    free(ponder_finish(board, &credit));
+    if (type != 's' || (value != NULL && atoi(value) == 0) || 
+            board_tiles(board) != NULL || handCount != HAND_SIZE - 1 ||
+            is_game_over(board, &deckCount, &emptyCards, width, height)) {
+        return;
+    }
+    ponder.board = create_board(width, height);
+    for (int i = 1; i < height + 1; i++) {
+        for (int j = 1; j < width + 1; j++) {
+            ponder.board[j][i] = board[j][i];
+        }
+    }
+    ponder.deck = malloc(sizeof(struct Card) * deckCount);
+    memcpy(ponder.deck, deck, sizeof(struct Card) * deckCount);
+    memcpy(ponder.theHand, theHand, sizeof(struct Card) * HAND_SIZE);
+    memcpy(ponder.opHand, opHand, sizeof(struct Card) * HAND_SIZE);
+    hand(ponder.deck, &deckCount, &opCount, ponder.opHand, &emptyCards);
+    ponder.player = player;
+    ponder.deckCount = deckCount;
+    ponder.emptyCards = emptyCards;
+    ponder.width = width;
+    ponder.height = height;
+    ponder.replies = NULL;
+    ponder.count = 0;
+    ponder.table = NULL;
+    ponder.stop = 0;
+    if (pthread_create(&ponder.thread, NULL, ponder_thread, &ponder) != 0) {
+        free_board(ponder.board, width);
+        free(ponder.deck);
+        return;
+    }
+    ponder.running = 1;
+}
+
+/*Translation invariant key of the cards on the board (see struct Canon),
+ * worked out from scratch. The anchor card is returned through anchorCol 
+ * and anchorRow (the center on an empty board).*/
+uint64_t canonical_key(struct Card** board, int w, int h, int* anchorCol, 
+        int* anchorRow) {
+    struct Canon canon;
+    canon_init(&canon, board, w, h);
+    canon_anchor(&canon, anchorCol, anchorRow);
+    canon_free(&canon);
+    return canon.key;
+}
+
+/*Key of an opening book position: the board up to translation, the board
+ * size, which player is to move (the suits they score for differ) and the
+ * cards in their hand*/
+uint64_t book_key(struct Card** board, int w, int h, int player, 
+        struct Card* theHand, int handCount, int* anchorCol, 
+        int* anchorRow) {
+    uint64_t key = canonical_key(board, w, h, anchorCol, anchorRow);
+    key ^= mix_key(((uint64_t)w << 32) | (uint64_t)h);
+    key ^= mix_key(((uint64_t)player << 48) | 0xB00C);
+    for (int i = 0; i < handCount; i++) {
+        if (theHand[i].number != 0) {
+            key += card_key(-1, theHand[i]);
+        }
+    }
+    return (key == 0) ? 1 : key;
+}
+
+/*Layout of an opening book file: a header followed by an open addressed
+ * table of slots (a power of two) probed linearly from key % slots. A key
+ * of 0 marks an empty slot. The move is the card to play and its offset 
+ * from the anchor given by canonical_key.*/
+struct BookHeader {
+    char magic[8];
+    uint32_t slots;
+    uint32_t count;
+};
+
+struct BookEntry {
+    uint64_t key;
+    char number;
+    char suit;
+    int16_t col;
+    int16_t row;
+    int16_t value;
+};
+
+/*The book currently open for lookups (mapped read only) or being built*/
+struct Book {
+    struct BookHeader* header;
+    struct BookEntry* entries;
+    size_t size;
+    int mapped;
+};
+
+/*Finds the slot for key: either the slot holding it or the empty slot where
+ * it would go*/
+struct BookEntry* book_slot(struct Book* book, uint64_t key) {
+    uint32_t mask = book->header->slots - 1;
+    uint32_t i = (uint32_t)key & mask;
+    while (book->entries[i].key != 0 && book->entries[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &book->entries[i];
+}
+
+/*Maps the book file read only. Returns 0 if it is missing or not a book.*/
+int book_open(struct Book* book, char* file) {
+    struct stat info;
+    int fd = open(file, O_RDONLY);
+    book->header = NULL;
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &info) != 0 || 
+            (size_t)info.st_size < sizeof(struct BookHeader)) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    book->header = data;
+    book->entries = (struct BookEntry*)(book->header + 1);
+    book->size = info.st_size;
+    book->mapped = 1;
+    if (memcmp(book->header->magic, BOOK_MAGIC, 8) != 0 || 
+            book->header->slots == 0 ||
+            (book->header->slots & (book->header->slots - 1)) != 0 ||
+            book->size < sizeof(struct BookHeader) + 
+            sizeof(struct BookEntry) * (size_t)book->header->slots) {
+        munmap(data, info.st_size);
+        book->header = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+/*The book 's' players read from, opened once by whichever thread needs it
+ * first*/
+struct Book book;
+pthread_once_t bookOnce = PTHREAD_ONCE_INIT;
+
+/*Opens the book named by BARK_BOOK (or BOOK_FILE) for book_lookup*/
+void book_open_default(void) {
+    char* file = getenv("BARK_BOOK");
+    book_open(&book, (file != NULL) ? file : BOOK_FILE);
+}
+
+/*Looks the position up in the opening book named by BARK_BOOK (or 
+ * BOOK_FILE). If the position is there and the
+ * move is still legal, move is filled in and 1 is returned. Book keys only
+ * hold up to translation on a wrapping board, so other boards never look
+ * moves up.*/
+int book_lookup(struct Card** board, int w, int h, int player, 
+        struct Card* theHand, struct Move* move) {
+    int anchorCol, anchorRow;
+    pthread_once(&bookOnce, book_open_default);
+    if (book.header == NULL || !TORUS) {
+        return 0;
+    }
+    uint64_t key = book_key(board, w, h, player, theHand, HAND_SIZE, 
+            &anchorCol, &anchorRow);
+    struct BookEntry* entry = book_slot(&book, key);
+    if (entry->key != key) {
+        return 0;
+    }
+    move->card = 0;
+    for (int i = 0; i < HAND_SIZE && move->card == 0; i++) {
+        if (theHand[i].number == entry->number && 
+                theHand[i].suit == entry->suit) {
+            move->card = i + 1;
+        }
+    }
+    move->col = wrap(anchorCol + entry->col, w);
+    move->row = wrap(anchorRow + entry->row, h);
+    return move->card != 0 && 
+            board_check(board, move->row, move->col, w, h) != 0;
+}
+
+/*Adds an entry while building, doubling the table when it is half full*/
+void book_add(struct Book* book, struct BookEntry* entry) {
+    if ((book->header->count + 1) * 2 > book->header->slots) {
+        struct Book bigger;
+        uint32_t slots = book->header->slots * 2;
+        bigger.header = calloc(1, sizeof(struct BookHeader) + 
+                sizeof(struct BookEntry) * (size_t)slots);
+        memcpy(bigger.header->magic, BOOK_MAGIC, 8);
+        bigger.header->slots = slots;
+        bigger.entries = (struct BookEntry*)(bigger.header + 1);
+        bigger.mapped = 0;
+        for (uint32_t i = 0; i < book->header->slots; i++) {
+            if (book->entries[i].key != 0) {
+                *book_slot(&bigger, book->entries[i].key) = book->entries[i];
+                bigger.header->count++;
+            }
+        }
+        if (book->mapped) {
+            munmap(book->header, book->size);
+        } else {
+            free(book->header);
+        }
+        *book = bigger;
+    }
+    struct BookEntry* slot = book_slot(book, entry->key);
+    if (slot->key == 0) {
+        book->header->count++;
+    }
+    *slot = *entry;
+}
+
+/*Walks every line of play from the current position for the first plies
+ * turns. Each position not yet in the book (up to translation) is searched
+ * BOOK_DEPTH turns ahead and its best move stored, then every placement of
+ * every card is followed to reach the next turn's positions.*/
+void book_expand(struct Solver* solver, struct Book* book, int side, 
+        int ply, int plies) {
+    int anchorCol, anchorRow;
+    if (ply >= plies) {
+        return;
+    }
+    uint64_t key = book_key(solver->board, solver->width, solver->height, 
+            side + 1, solver->hands[side], solver->handCounts[side], 
+            &anchorCol, &anchorRow);
+    if (book_slot(book, key)->key == key) {
+        return;
+    }
+    struct BookEntry entry;
+    struct Move best;
+    memset(solver->table, 0, sizeof(struct Entry) * SOLVER_TABLE_SIZE);
+    budget_start(&solver->budget);
+    solver->limit = solver->next + BOOK_DEPTH;
+    entry.key = key;
+    entry.value = solver_search(solver, side, -1000, 1000, &best);
+    if (best.card == 0) {
+        return;
+    }
+    entry.number = solver->hands[side][best.card - 1].number;
+    entry.suit = solver->hands[side][best.card - 1].suit;
+    entry.col = best.col - anchorCol;
+    entry.row = best.row - anchorRow;
+    book_add(book, &entry);
+
+    int count;
+    struct Move* moves = solver_moves(solver, side, &count);
+    for (int i = 0; i < count; i++) {
+        struct Undo undo;
+        solver_apply(solver, side, moves[i], &undo);
+        if (!undo.over) {
+            book_expand(solver, book, 1 - side, ply + 1, plies);
+        }
+        solver_revert(solver, side, moves[i], &undo);
+    }
+}
+
+/*Builds (or adds to) an opening book: bark -book bookfile deckfile width 
+ * height [turns]. The game is dealt from the deckfile the way start_game
+ * does and every position of the first turns (BOOK_TURNS by default) is
+ * added. Running it again with other decks or sizes extends the same file,
+ * which is replaced whole (by way of a temporary file) so 's' players with
+ * the old book mapped keep reading it safely. Sparse boards have no book,
+ * as 's' players play them greedily.*/
+void build_book(int argc, char** argv) {
+    struct Book book;
+    struct Solver solver;
+    int deckCount = 0;
+    int emptyCards = 0;
+    int p1HandCount = 0;
+    int p2HandCount = 0;
+    if (argc != 6 && argc != 7) {
+        fprintf(stderr, "Usage: bark -book bookfile deckfile width height");
+        fprintf(stderr, " [turns]\n");
+        exit(1);
+    }
+    int width = atoi(argv[4]);
+    int height = atoi(argv[5]);
+    int plies = (argc == 7) ? atoi(argv[6]) : BOOK_TURNS;
+    code_check("a", "a", width, height);
+    if ((long)width * height > DENSE_CELLS) {
+        fprintf(stderr, "Incorrect arg types\n");
+        exit(2);
+    }
+    struct Card* deck = init_deck(argv[3], &deckCount);
+    struct Card* p1Hand = calloc(HAND_SIZE, sizeof(struct Card));
+    struct Card* p2Hand = calloc(HAND_SIZE, sizeof(struct Card));
+    hand(deck, &deckCount, &p1HandCount, p1Hand, &emptyCards);
+    hand(deck, &deckCount, &p2HandCount, p2Hand, &emptyCards);
+    hand(deck, &deckCount, &p1HandCount, p1Hand, &emptyCards);
+    struct Card** board = create_board(width, height);
+
+    if (book_open(&book, argv[2])) {
+        struct Book copy;
+        copy.header = calloc(1, sizeof(struct BookHeader) + 
+                sizeof(struct BookEntry) * (size_t)book.header->slots);
+        memcpy(copy.header, book.header, sizeof(struct BookHeader) + 
+                sizeof(struct BookEntry) * (size_t)book.header->slots);
+        copy.entries = (struct BookEntry*)(copy.header + 1);
+        copy.mapped = 0;
+        munmap(book.header, book.size);
+        book = copy;
+    } else {
+        book.header = calloc(1, sizeof(struct BookHeader) + 
+                sizeof(struct BookEntry) * 1024);
+        memcpy(book.header->magic, BOOK_MAGIC, 8);
+        book.header->slots = 1024;
+        book.entries = (struct BookEntry*)(book.header + 1);
+        book.mapped = 0;
+    }
+    solver_init(&solver, 1, p1Hand, p2Hand, board, deck, deckCount, 
+            emptyCards, width, height);
+    book_expand(&solver, &book, 0, 0, plies);
+    solver_free(&solver);
+
+    char* temp = malloc(strlen(argv[2]) + 5);
+    sprintf(temp, "%s.tmp", argv[2]);
+    if (!write_atomic(argv[2], temp, (char*)book.header, 
+            sizeof(struct BookHeader) + sizeof(struct BookEntry) * 
+            (size_t)book.header->slots)) {
+        fprintf(stderr, "Unable to write book\n");
+        exit(3);
+    }
+    free(temp);
+    fprintf(stdout, "%u positions\n", book.header->count);
+    exit(0);
+}
+
+/*Solver turn is used for the 's' type. Its first turns come from the
+ * opening book when the position is in it. Otherwise it uses deepen_search
+ * within the move's budget, or endgame_solve once only a few cards are 
+ * left in the deck, to find the placement giving it the best final score.
+ * Sparse boards are too big to search and are played greedily.*/
+void solver_turn(int player, struct Card* theHand, struct Card** board, 
+        struct Card* deck, int* deckCount, int* handCount, int* emptyCards,
+        int width, int height, struct Card* opHand) {
+    int type = 1;
+    int value;
+    struct Move move;
+    if (is_game_over(board, deckCount, emptyCards, width, height)) {
+        ai(player, theHand, board, deck, deckCount, handCount, emptyCards, 
+                width, height);
+        return;
+    }
+    if (board_tiles(board) != NULL) {
+        greedy_turn(player, theHand, board, deck, deckCount, handCount, 
+                emptyCards, width, height, &params);
+        return;
+    }
+    int endgame = (*deckCount - *emptyCards <= endgame_cards());
+    hand(deck, deckCount, handCount, theHand, emptyCards);
+    print_hand(theHand, player, type);
+    long credit;
+    struct Entry* table = ponder_finish(board, &credit);
+    if (endgame) {
+        move = endgame_solve(player, theHand, opHand, board, deck,
+                *deckCount, *emptyCards, width, height, &value, table, 
+                credit);
+    } else if (!book_lookup(board, width, height, player, theHand, 
+            &move)) {
+        move = deepen_search(player, theHand, opHand, board, deck, 
+                *deckCount, *emptyCards, width, height, &value, table, 
+                credit);
+    } else {
+        free(table);
+    }
+    place_shuffle(theHand, board, move.row, move.col, move.card, handCount);
+    print_play(player, board, move.col, move.row);
+    draw_board(board, width, height);
+}
+
+/*Makes sure the stack of a board's Greedy can hold every card on the 
+ * board, as placement_scores may need it to*/
+void greedy_stack(struct Greedy* greedy, struct Card** board) {
+    long need = (board_tiles(board) != NULL) ? board_tiles(board)->cards + 
+            2 : (long)greedy->width * greedy->height + 1;
+    if (greedy->stackSpace < need) {
+        greedy->stackSpace = need * 2;
+        greedy->stack = realloc(greedy->stack, sizeof(long) * 
+                greedy->stackSpace);
+    }
+}
+
+/*Returns what 'g' players keep about board between turns, working it out
+ * the first time: both players' best scores as best_scores counts them.
+ * placement_scores' seen (dense boards only), stamp and stack are kept 
+ * with them, so a turn allocates and clears nothing. From then on 
+ * place_card keeps it up to date through greedy_place, so turns only look 
+ * at the cells next to cards (see frontier_state) instead of rescanning 
+ * the board.*/
+struct Greedy* greedy_state(struct Card** board, int w, int h) {
+    struct Greedy* greedy = board_greedy(board);
+    if (greedy != NULL) {
+        return greedy;
+    }
+    greedy = calloc(1, sizeof(struct Greedy));
+    greedy->width = w;
+    greedy->height = h;
+    best_scores(board, w, h, NULL, 0, &greedy->p1, &greedy->p2);
+    if (board_tiles(board) == NULL) {
+        greedy->seen = calloc((size_t)w * h, sizeof(int));
+    }
+    board[-2] = (struct Card*)(void*)greedy;
+    return greedy;
+}
+
+/*Brings a board's Greedy up to date with card being placed at col and row
+ * (still empty). Only the cards with a path into it can score more.*/
+void greedy_place(struct Greedy* greedy, struct Card** board, int col, 
+        int row, struct Card card) {
+    greedy_stack(greedy, board);
+    placement_scores(board, greedy->width, greedy->height, col, row, card, 
+            greedy->seen, ++greedy->stamp, greedy->stack, &greedy->p1, 
+            &greedy->p2);
+}
+
+/*Greedy turn is used for the 'g' type. Every card in the hand is tried on
+ * every cell it could be placed on, and the placement with the highest 
+ * value is played. With the standard weights that is the one leaving the
+ * player furthest ahead of the other player (own best score minus theirs,
+ * as print_score would count them); other weights also count the card's
+ * rank and the cards around the cell. Ties go to the first card and the 
+ * first cell from the top left. If the move's budget runs out the best
+ * placement tried so far is played.*/
+void greedy_turn(int player, struct Card* theHand, struct Card** board, 
+        struct Card* deck, int* deckCount, int* handCount, int* emptyCards,
+        int width, int height, struct Params* weights) {
+    int type = 1;
+    double bestValue = -HUGE_VAL;
+    struct Budget budget;
+    struct Move best = {1, (width + 1) / 2, (height + 1) / 2};
+    long center = (long)(best.row - 1) * width + best.col - 1;
+    long bestCell = center;
+    budget_start(&budget);
+    budget.clockMask = 0;
+    if (is_game_over(board, deckCount, emptyCards, width, height)) {
+        ai(player, theHand, board, deck, deckCount, handCount, emptyCards, 
+                width, height);
+        return;
+    }
+    hand(deck, deckCount, handCount, theHand, emptyCards);
+    print_hand(theHand, player, type);
+    struct Greedy* greedy = greedy_state(board, width, height);
+    struct Frontier* frontier = frontier_state(board, width, height);
+    long count = (frontier->count > 0) ? frontier->count : 1;
+    long* cells = (frontier->count > 0) ? frontier->cells : &center;
+    greedy_stack(greedy, board);
+    for (long k = 0; k < count && !budget.expired; k++) {
+        int j = cells[k] % width + 1;
+        int i = cells[k] / width + 1;
+        int cols[4] = {j, j, wrap(j + 1, width), wrap(j - 1, width)};
+        int rows[4] = {wrap(i - 1, height), wrap(i + 1, height), i, i};
+        for (int card = 0; card < HAND_SIZE; card++) {
+            int newP1 = greedy->p1;
+            int newP2 = greedy->p2;
+            int lower = 0, higher = 0;
+            if (theHand[card].number == 0) {
+                continue;
+            }
+            if (bestValue > -HUGE_VAL && budget_expired(&budget)) {
+                break;
+            }
+            placement_scores(board, width, height, j, i, theHand[card], 
+                    greedy->seen, ++greedy->stamp, greedy->stack, &newP1, 
+                    &newP2);
+            for (int n = 0; n < 4; n++) {
+                int number = board_cell(board, cols[n], rows[n])->number;
+                lower += (number != 0 && number < theHand[card].number);
+                higher += (number > theHand[card].number);
+            }
+            double value = weights->own * ((player == 1) ? newP1 : newP2) -
+                    weights->theirs * ((player == 1) ? newP2 : newP1) + 
+                    weights->rank * theHand[card].number + 
+                    weights->lower * lower + weights->higher * higher;
+            if (value > bestValue || (value == bestValue && 
+                    cells[k] < bestCell)) {
+                bestValue = value;
+                bestCell = cells[k];
+                best.card = card + 1;
+                best.col = j;
+                best.row = i;
+            }
+        }
+    }
+    place_shuffle(theHand, board, best.row, best.col, best.card, handCount);
+    print_play(player, board, best.col, best.row);
+    draw_board(board, width, height);
+}
+
+/*Plays a turn for one of the automated types, a 'g' player using weights,
+ * and returns how long it took in microseconds. With BARK_LATENCY set the
+ * time is also reported on stderr against the move budget.*/
+long auto_turn(char type, int player, struct Card* theHand, 
+        struct Card** board, struct Card* deck, int* deckCount, 
+        int* handCount, int* emptyCards, int width, int height, 
+        struct Card* opHand, struct Params* weights) {
+    struct Budget budget;
+    budget_start(&budget);
+    if (type == 's') {
+        solver_turn(player, theHand, board, deck, deckCount, handCount, 
+                emptyCards, width, height, opHand);
+    } else if (type == 'g') {
+        greedy_turn(player, theHand, board, deck, deckCount, handCount, 
+                emptyCards, width, height, weights);
+    } else {
+        ai(player, theHand, board, deck, deckCount, handCount, emptyCards, 
+                width, height);
+    }
+    long elapsed = budget_elapsed(&budget);
+    if (getenv("BARK_LATENCY") != NULL) {
+        fprintf(stderr, "Player %d took %ldus of %dms\n", player, elapsed, 
+                move_ms());
+    }
+    return elapsed;
+}
+
+/*How one bulk game went. first is the player who moved first, turns the
+ * number of cards placed, dealt the number of deck cards used and 
+ * latencies the move times (see STATS_LATENCIES).*/
+struct Result {
+    int p1;
+    int p2;
+    int first;
+    int turns;
+    int dealt;
+    long late;
+    long latencies[STATS_LATENCIES];
+};
+
+/*A training data file written by one bark -export thread, mapped into 
+ * memory and filled in place, so no locks or writes are needed. It starts
+ * at EXPORT_FIRST bytes and grows by its own size, up to EXPORT_CHUNK, 
+ * each time it fills. Every chunk is allocated on disk before it is 
+ * mapped, and the file is cut to its records when closed. The header holds
+ * EXPORT_MAGIC and then, as 32 bit numbers, the width, height, hand size 
+ * and record size, then the number of records as a 64 bit number.
+ *
+ * A record is one move: the player moving, the card played (1 to 
+ * HAND_SIZE), its column and row as 16 bit numbers, both final scores 
+ * and the number of cards dealt as a 32 bit number, then the hand (rank 
+ * and suit of HAND_LIMIT cards, 0 past the hand) and three planes of one 
+ * byte per cell, row by row: occupied, rank, and the owner of the suit 
+ * (1 or 2, its parity in the standard game). Numbers are in the machine's
+ * own byte order. The scores are filled in when the game ends; the rest 
+ * describes the position before the move.*/
+struct Shard {
+    int fd;
+    unsigned char* map;
+    size_t size;
+    int width;
+    int height;
+    size_t recordSize;
+    long records;
+    long gameStart;
+};
+
+/*Byte offsets of the parts of a record*/
+#define RECORD_CARD 1
+#define RECORD_COL 2
+#define RECORD_ROW 4
+#define RECORD_SCORES 6
+#define RECORD_DEALT 8
+#define RECORD_HAND 12
+#define RECORD_PLANES (RECORD_HAND + HAND_LIMIT * 2)
+
+/*Maps size bytes of shard's file, allocating them on disk first. Returns
+ * 0 if it cannot.*/
+int shard_map(struct Shard* shard, size_t size) {
+    if (shard->map != NULL) {
+        munmap(shard->map, shard->size);
+        shard->map = NULL;
+    }
+    if (posix_fallocate(shard->fd, 0, size) != 0) {
+        return 0;
+    }
+    shard->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, 
+            shard->fd, 0);
+    if (shard->map == MAP_FAILED) {
+        shard->map = NULL;
+        return 0;
+    }
+    shard->size = size;
+    return 1;
+}
+
+/*Opens file as a shard for width x height boards. Returns 0 if it cannot
+ * be made.*/
+int shard_open(struct Shard* shard, char* file, int width, int height) {
+    memset(shard, 0, sizeof(struct Shard));
+    shard->width = width;
+    shard->height = height;
+    shard->recordSize = (RECORD_PLANES + 3 * (size_t)width * height + 7) /
+            8 * 8;
+    shard->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (shard->fd < 0 || !shard_map(shard, EXPORT_HEADER + 
+            (EXPORT_FIRST / shard->recordSize + 1) * shard->recordSize)) {
+        return 0;
+    }
+    uint32_t fields[4] = {width, height, HAND_SIZE, shard->recordSize};
+    memcpy(shard->map, EXPORT_MAGIC, 8);
+    memcpy(shard->map + 8, fields, sizeof(fields));
+    return 1;
+}
+
+/*Starts a record of the position before player moves with theHand, 
+ * returning where it is. Exits if the shard cannot grow.*/
+unsigned char* shard_record(struct Shard* shard, struct Card** board, 
+        int player, struct Card* theHand, int emptyCards) {
+    size_t at = EXPORT_HEADER + shard->records * shard->recordSize;
+    size_t chunk = (shard->size < EXPORT_CHUNK) ? shard->size : EXPORT_CHUNK;
+    if (at + shard->recordSize > shard->size && !shard_map(shard, 
+            shard->size + (chunk / shard->recordSize + 1) * 
+            shard->recordSize)) {
+        fprintf(stderr, "Unable to write export\n");
+        exit(3);
+    }
+    unsigned char* record = shard->map + at;
+    size_t cells = (size_t)shard->width * shard->height;
+    uint32_t dealt = emptyCards;
+    shard->records++;
+    memset(record, 0, RECORD_PLANES);
+    record[0] = player;
+    memcpy(record + RECORD_DEALT, &dealt, sizeof(dealt));
+    for (int i = 0; i < HAND_SIZE; i++) {
+        record[RECORD_HAND + i * 2] = theHand[i].number;
+        record[RECORD_HAND + i * 2 + 1] = theHand[i].suit;
+    }
+    for (int row = 1; row < shard->height + 1; row++) {
+        for (int col = 1; col < shard->width + 1; col++) {
+            size_t cell = RECORD_PLANES + (size_t)(row - 1) * shard->width +
+                    col - 1;
+            struct Card card = board[col][row];
+            record[cell] = (card.number != 0);
+            record[cell + cells] = card.number;
+            record[cell + cells * 2] = (card.number != 0) ? 
+                    PLAYER_OF(card.suit) : 0;
+        }
+    }
+    return record;
+}
+
+/*Fills in the move made since record was started: the card is the first
+ * place theHand no longer matches the hand recorded, and the cell the one
+ * that was empty and no longer is*/
+void shard_move(struct Shard* shard, unsigned char* record, 
+        struct Card** board, struct Card* theHand) {
+    int card = HAND_SIZE;
+    for (int i = 0; i < HAND_SIZE - 1 && card == HAND_SIZE; i++) {
+        if (theHand[i].number != record[RECORD_HAND + i * 2] || 
+                theHand[i].suit != record[RECORD_HAND + i * 2 + 1]) {
+            card = i + 1;
+        }
+    }
+    record[RECORD_CARD] = card;
+    for (int row = 1; row < shard->height + 1; row++) {
+        for (int col = 1; col < shard->width + 1; col++) {
+            if (board[col][row].number != 0 && record[RECORD_PLANES + 
+                    (size_t)(row - 1) * shard->width + col - 1] == 0) {
+                uint16_t place[2] = {col, row};
+                memcpy(record + RECORD_COL, place, sizeof(place));
+                return;
+            }
+        }
+    }
+}
+
+/*Fills in the final scores of the game just played in every record of it*/
+void shard_outcome(struct Shard* shard, int p1, int p2) {
+    for (long i = shard->gameStart; i < shard->records; i++) {
+        unsigned char* record = shard->map + EXPORT_HEADER + 
+                i * shard->recordSize;
+        record[RECORD_SCORES] = p1;
+        record[RECORD_SCORES + 1] = p2;
+    }
+    shard->gameStart = shard->records;
+}
+
+/*Writes the record count and cuts the shard's file down to its records*/
+void shard_close(struct Shard* shard) {
+    uint64_t records = shard->records;
+    memcpy(shard->map + 24, &records, sizeof(records));
+    munmap(shard->map, shard->size);
+    if (ftruncate(shard->fd, EXPORT_HEADER + records * shard->recordSize) 
+            != 0) {
+        fprintf(stderr, "Unable to write export\n");
+    }
+    close(shard->fd);
+}
+
+/*Plays a game between two automated types on from where it stands, with
+ * player turn to move, without printing or exiting, and fills in result. 
+ * The board, hands and deck are played on. weights, unless NULL, holds 
+ * each player's weights in place of the loaded ones.*/
+void play_out(char* types, struct Card hands[2][HAND_LIMIT], int* handCounts,
+        struct Card** board, struct Card* deck, int deckCount, 
+        int emptyCards, int width, int height, int turn, 
+        struct Result* result, struct Shard* shard, struct Params* weights) {
+    result->first = turn;
+    result->turns = 0;
+    result->late = 0;
+    memset(result->latencies, 0, sizeof(result->latencies));
+    int side = turn - 1;
+    while (is_game_over(board, &deckCount, &emptyCards, width, height) == 0) {
+        int bucket = 0;
+        unsigned char* record = NULL;
+        if (shard != NULL) {
+            struct Card dealt[HAND_LIMIT];
+            int drawn = (handCounts[side] == HAND_SIZE - 1);
+            memcpy(dealt, hands[side], sizeof(dealt));
+            if (drawn) {
+                dealt[HAND_SIZE - 1] = deck[emptyCards];
+            }
+            record = shard_record(shard, board, side + 1, dealt, 
+                    emptyCards + drawn);
+        }
+        long elapsed = auto_turn(types[side], side + 1, hands[side], board, 
+                deck, &deckCount, &handCounts[side], &emptyCards, width, 
+                height, hands[1 - side], (weights != NULL) ? &weights[side] :
+                &params);
+        if (record != NULL) {
+            shard_move(shard, record, board, hands[side]);
+        }
+        while (bucket < STATS_LATENCIES - 1 && (1L << (bucket + 1)) <= 
+                elapsed) {
+            bucket++;
+        }
+        result->latencies[bucket]++;
+        result->late += (elapsed > move_ms() * 1000L);
+        result->turns++;
+        side = 1 - side;
+    }
+    best_scores(board, width, height, NULL, 0, &result->p1, &result->p2);
+    result->dealt = emptyCards;
+    if (shard != NULL) {
+        shard_outcome(shard, result->p1, result->p2);
+    }
+}
+
+/*Plays one game between two automated types the way start_game and 
+ * play_game do, without printing or exiting, and fills in result. The 
+ * deck is dealt from (and changed), so pass in a copy. Every move is 
+ * recorded in shard unless it is NULL, and weights are as for play_out.*/
+void simulate_game(char p1, char p2, struct Card* deck, int deckCount, 
+        int width, int height, int turn, struct Result* result, 
+        struct Shard* shard, struct Params* weights) {
+    int emptyCards = 0;
+    int handCounts[2] = {0, 0};
+    struct Card hands[2][HAND_LIMIT];
+    char types[2] = {p1, p2};
+    struct Card** board = create_board(width, height);
+    memset(hands, 0, sizeof(hands));
+    hand(deck, &deckCount, &handCounts[0], hands[0], &emptyCards);
+    hand(deck, &deckCount, &handCounts[1], hands[1], &emptyCards);
+    play_out(types, hands, handCounts, board, deck, deckCount, emptyCards, 
+            width, height, turn, result, shard, weights);
+    free_board(board, width);
+}
+
+/*Running totals for one (board size, deck, player types) combination. 
+ * Everything is a count or a sum so two Stats for the same key merge by
+ * adding, and memory does not grow with the number of games. Scores can 
+ * only be 0 to RANK_LIMIT so their histograms are exact; game lengths and move 
+ * times go in power of two buckets and deck use in tenths. late counts the
+ * moves that went over the move budget.*/
+struct Stats {
+    int width;
+    int height;
+    char deck[80];
+    char p1;
+    char p2;
+    long games;
+    long p1Wins;
+    long p2Wins;
+    long firstWins;
+    long turns;
+    long dealt;
+    long cards;
+    long scores[2][STATS_SCORES];
+    long lengths[STATS_LENGTHS];
+    long used[STATS_USED];
+    long late;
+    long latencies[STATS_LATENCIES];
+};
+
+/*Adds one game to the totals*/
+void stats_add(struct Stats* stats, struct Result* result, int deckCount) {
+    int bucket = 0;
+    stats->games++;
+    if (result->p1 > result->p2) {
+        stats->p1Wins++;
+    } else if (result->p2 > result->p1) {
+        stats->p2Wins++;
+    }
+    if ((result->first == 1 && result->p1 > result->p2) || 
+            (result->first == 2 && result->p2 > result->p1)) {
+        stats->firstWins++;
+    }
+    stats->turns += result->turns;
+    stats->dealt += result->dealt;
+    stats->cards += deckCount;
+    stats->scores[0][result->p1]++;
+    stats->scores[1][result->p2]++;
+    while (bucket < STATS_LENGTHS - 1 && (1 << (bucket + 1)) <= result->turns) {
+        bucket++;
+    }
+    stats->lengths[bucket]++;
+    stats->used[result->dealt * 10 / deckCount]++;
+    stats->late += result->late;
+    for (int i = 0; i < STATS_LATENCIES; i++) {
+        stats->latencies[i] += result->latencies[i];
+    }
+}
+
+/*Adds the totals of other into stats (same key), used to combine the 
+ * threads of a run and the rows already in a stats file*/
+void stats_merge(struct Stats* stats, struct Stats* other) {
+    stats->games += other->games;
+    stats->p1Wins += other->p1Wins;
+    stats->p2Wins += other->p2Wins;
+    stats->firstWins += other->firstWins;
+    stats->turns += other->turns;
+    stats->dealt += other->dealt;
+    stats->cards += other->cards;
+    for (int i = 0; i < STATS_SCORES; i++) {
+        stats->scores[0][i] += other->scores[0][i];
+        stats->scores[1][i] += other->scores[1][i];
+    }
+    for (int i = 0; i < STATS_LENGTHS; i++) {
+        stats->lengths[i] += other->lengths[i];
+    }
+    for (int i = 0; i < STATS_USED; i++) {
+        stats->used[i] += other->used[i];
+    }
+    stats->late += other->late;
+    for (int i = 0; i < STATS_LATENCIES; i++) {
+        stats->latencies[i] += other->latencies[i];
+    }
+}
+
+/*Returns the bucket at fraction q of the way through a histogram*/
+int stats_quantile(long* histogram, int buckets, long total, double q) {
+    long seen = 0;
+    for (int i = 0; i < buckets; i++) {
+        seen += histogram[i];
+        if (seen > 0 && seen >= q * total) {
+            return i;
+        }
+    }
+    return buckets - 1;
+}
+
+/*Writes one CSV row. The means, rates and quantiles are there to be read, 
+ * the counts after them are what stats_read uses to merge the row back.*/
+void stats_write(FILE* output, struct Stats* stats) {
+    double games = (stats->games > 0) ? stats->games : 1;
+    double mean[2] = {0, 0};
+    for (int i = 0; i < STATS_SCORES; i++) {
+        mean[0] += i * stats->scores[0][i] / games;
+        mean[1] += i * stats->scores[1][i] / games;
+    }
+    fprintf(output, "%d,%d,%s,%c,%c,%.4f,%.4f,%.4f,%.2f,%.4f", stats->width,
+            stats->height, stats->deck, stats->p1, stats->p2, 
+            stats->p1Wins / games, stats->p2Wins / games, 
+            stats->firstWins / games, stats->turns / games, 
+            stats->cards > 0 ? (double)stats->dealt / stats->cards : 0);
+    for (int p = 0; p < 2; p++) {
+        fprintf(output, ",%.3f,%d,%d,%d", mean[p], 
+                stats_quantile(stats->scores[p], STATS_SCORES, stats->games,
+                        0.1),
+                stats_quantile(stats->scores[p], STATS_SCORES, stats->games,
+                        0.5),
+                stats_quantile(stats->scores[p], STATS_SCORES, stats->games,
+                        0.9));
+    }
+    fprintf(output, ",%ld,%ld,%.4f", 1L << (stats_quantile(stats->latencies,
+            STATS_LATENCIES, stats->turns, 0.5) + 1), 1L << 
+            (stats_quantile(stats->latencies, STATS_LATENCIES, stats->turns, 
+            0.99) + 1), stats->turns > 0 ? (double)stats->late / 
+            stats->turns : 0);
+    fprintf(output, ",%ld,%ld,%ld,%ld,%ld,%ld,%ld", stats->games, 
+            stats->p1Wins, stats->p2Wins, stats->firstWins, stats->turns, 
+            stats->dealt, stats->cards);
+    for (int p = 0; p < 2; p++) {
+        for (int i = 0; i < STATS_SCORES; i++) {
+            fprintf(output, ",%ld", stats->scores[p][i]);
+        }
+    }
+    for (int i = 0; i < STATS_LENGTHS; i++) {
+        fprintf(output, ",%ld", stats->lengths[i]);
+    }
+    for (int i = 0; i < STATS_USED; i++) {
+        fprintf(output, ",%ld", stats->used[i]);
+    }
+    fprintf(output, ",%ld", stats->late);
+    for (int i = 0; i < STATS_LATENCIES; i++) {
+        fprintf(output, ",%ld", stats->latencies[i]);
+    }
+    fprintf(output, "\n");
+}
+
+/*Reads a row written by stats_write back into stats, returning 1 if the
+ * row was complete*/
+int stats_read(char* line, struct Stats* stats) {
+    long* counts[8 + STATS_SCORES * 2 + STATS_LENGTHS + STATS_USED + 
+            STATS_LATENCIES];
+    int field = 0;
+    char* next;
+    memset(stats, 0, sizeof(struct Stats));
+    counts[0] = &stats->games;
+    counts[1] = &stats->p1Wins;
+    counts[2] = &stats->p2Wins;
+    counts[3] = &stats->firstWins;
+    counts[4] = &stats->turns;
+    counts[5] = &stats->dealt;
+    counts[6] = &stats->cards;
+    for (int i = 0; i < STATS_SCORES * 2; i++) {
+        counts[7 + i] = &stats->scores[i / STATS_SCORES][i % STATS_SCORES];
+    }
+    for (int i = 0; i < STATS_LENGTHS; i++) {
+        counts[7 + STATS_SCORES * 2 + i] = &stats->lengths[i];
+    }
+    for (int i = 0; i < STATS_USED; i++) {
+        counts[7 + STATS_SCORES * 2 + STATS_LENGTHS + i] = &stats->used[i];
+    }
+    counts[7 + STATS_SCORES * 2 + STATS_LENGTHS + STATS_USED] = &stats->late;
+    for (int i = 0; i < STATS_LATENCIES; i++) {
+        counts[8 + STATS_SCORES * 2 + STATS_LENGTHS + STATS_USED + i] = 
+                &stats->latencies[i];
+    }
+    if (sscanf(line, "%d,%d,%79[^,],%c,%c", &stats->width, &stats->height,
+            stats->deck, &stats->p1, &stats->p2) != 5) {
+        return 0;
+    }
+    for (next = line; *next != '\0'; next++) {
+        if (*next != ',') {
+            continue;
+        }
+        field++;
+        if (field >= 21 && field - 21 < (int)(sizeof(counts) / 
+                sizeof(counts[0]))) {
+            *counts[field - 21] = atol(next + 1);
+        }
+    }
+    return field == 20 + (int)(sizeof(counts) / sizeof(counts[0]));
+}
+
+/*Shuffles a deck (Fisher-Yates) with a generator seeded from seed, so 
+ * every game of a run gets its own deal and runs can be repeated*/
+void shuffle_deck(struct Card* deck, int deckCount, uint64_t seed) {
+    for (int i = deckCount - 1; i > 0; i--) {
+        seed = mix_key(seed);
+        int j = (int)(seed % (uint64_t)(i + 1));
+        struct Card temp = deck[i];
+        deck[i] = deck[j];
+        deck[j] = temp;
+    }
+}
+
+/*What each bulk thread plays and where it keeps its totals*/
+struct StatsJob {
+    struct Stats stats;
+    struct Card* deck;
+    int deckCount;
+    long first;
+    long games;
+    long step;
+};
+
+/*Thread body for bark -stats: plays games first, first + step, ... 
+ * alternating who moves first and adding each to its own totals*/
+void* stats_thread(void* data) {
+    struct StatsJob* job = data;
+    struct Card* deck = malloc(sizeof(struct Card) * job->deckCount);
+    struct Result result;
+    for (long game = job->first; game < job->games; game += job->step) {
+        memcpy(deck, job->deck, sizeof(struct Card) * job->deckCount);
+        shuffle_deck(deck, job->deckCount, (uint64_t)game);
+        simulate_game(job->stats.p1, job->stats.p2, deck, job->deckCount, 
+                job->stats.width, job->stats.height, 1 + (int)(game % 2), 
+                &result, NULL, NULL);
+        stats_add(&job->stats, &result, job->deckCount);
+    }
+    free(deck);
+    return NULL;
+}
+
+/*Runs a batch of automated games and adds their statistics to a CSV file:
+ * bark -stats statsfile games threads deckfile width height p1type p2type.
+ * Each game uses its own shuffle of the deck and the players take turns 
+ * moving first. Rows already in the file are kept, and the row for the 
+ * same size, deck and types is merged with the new games, so several runs
+ * (or processes) can share one file: the merge holds a lock on 
+ * statsfile.lock and the file is replaced whole, never rewritten in place.*/
+void run_stats(int argc, char** argv) {
+    int deckCount = 0;
+    int rowCount = 0;
+    int threads;
+    long games;
+    if (argc != 10) {
+        fprintf(stderr, "Usage: bark -stats statsfile games threads deckfile");
+        fprintf(stderr, " width height p1type p2type\n");
+        exit(1);
+    }
+    games = atol(argv[3]);
+    threads = atoi(argv[4]);
+    int width = atoi(argv[6]);
+    int height = atoi(argv[7]);
+    code_check(argv[8], argv[9], width, height);
+    if (games < 1 || threads < 1 || *argv[8] == 'h' || *argv[9] == 'h' ||
+            *argv[8] == 'e' || *argv[9] == 'e') {
+        fprintf(stderr, "Incorrect arg types\n");
+        exit(2);
+    }
+    struct Card* deck = init_deck(argv[5], &deckCount);
+    struct StatsJob* jobs = calloc(threads, sizeof(struct StatsJob));
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    quiet = 1;
+    for (int t = 0; t < threads; t++) {
+        jobs[t].stats.width = width;
+        jobs[t].stats.height = height;
+        snprintf(jobs[t].stats.deck, sizeof(jobs[t].stats.deck), "%s", 
+                argv[5]);
+        jobs[t].stats.p1 = *argv[8];
+        jobs[t].stats.p2 = *argv[9];
+        jobs[t].deck = deck;
+        jobs[t].deckCount = deckCount;
+        jobs[t].first = t;
+        jobs[t].games = games;
+        jobs[t].step = threads;
+        pthread_create(&ids[t], NULL, stats_thread, &jobs[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        if (t > 0) {
+            stats_merge(&jobs[0].stats, &jobs[t].stats);
+        }
+    }
+
+    char* lockName = malloc(strlen(argv[2]) + 6);
+    char* temp = malloc(strlen(argv[2]) + 5);
+    sprintf(lockName, "%s.lock", argv[2]);
+    sprintf(temp, "%s.tmp", argv[2]);
+    int lock = open(lockName, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0) {
+        fprintf(stderr, "Unable to lock stats\n");
+        exit(3);
+    }
+    struct Stats* rows = malloc(sizeof(struct Stats));
+    char** kept = NULL;
+    int keptCount = 0;
+    FILE* input = fopen(argv[2], "r");
+    int merged = 0;
+    if (input != NULL) {
+        char* line = NULL;
+        size_t size = 0;
+        while (getline(&line, &size, input) > 0) {
+            if (strncmp(line, "width,", 6) == 0) {
+                continue;
+            }
+            rows = realloc(rows, sizeof(struct Stats) * (rowCount + 1));
+            if (!stats_read(line, &rows[rowCount])) {
+                /*Rows that do not parse are written back as they are*/
+                kept = realloc(kept, sizeof(char*) * (keptCount + 1));
+                kept[keptCount++] = strdup(line);
+                continue;
+            }
+            struct Stats* row = &rows[rowCount];
+            if (row->width == width && row->height == height && 
+                    row->p1 == *argv[8] && row->p2 == *argv[9] &&
+                    strcmp(row->deck, argv[5]) == 0) {
+                stats_merge(row, &jobs[0].stats);
+                merged = 1;
+            }
+            rowCount++;
+        }
+        free(line);
+        fclose(input);
+    }
+    if (!merged) {
+        rows = realloc(rows, sizeof(struct Stats) * (rowCount + 1));
+        rows[rowCount++] = jobs[0].stats;
+    }
+    char* text;
+    size_t length;
+    FILE* output = open_memstream(&text, &length);
+    fprintf(output, "width,height,deck,p1type,p2type,p1_win_rate,");
+    fprintf(output, "p2_win_rate,first_win_rate,mean_turns,deck_used");
+    for (int p = 1; p < 3; p++) {
+        fprintf(output, ",p%d_mean,p%d_p10,p%d_p50,p%d_p90", p, p, p, p);
+    }
+    fprintf(output, ",move_p50_us,move_p99_us,over_budget_rate");
+    fprintf(output, ",games,p1_wins,p2_wins,first_wins,turns,dealt,cards");
+    for (int p = 1; p < 3; p++) {
+        for (int i = 0; i < STATS_SCORES; i++) {
+            fprintf(output, ",p%d_score%d", p, i);
+        }
+    }
+    for (int i = 0; i < STATS_LENGTHS; i++) {
+        fprintf(output, ",turns_%d", 1 << i);
+    }
+    for (int i = 0; i < STATS_USED; i++) {
+        fprintf(output, ",used_%d", i * 10);
+    }
+    fprintf(output, ",late");
+    for (int i = 0; i < STATS_LATENCIES; i++) {
+        fprintf(output, ",move_%ldus", 1L << i);
+    }
+    fprintf(output, "\n");
+    for (int i = 0; i < rowCount; i++) {
+        stats_write(output, &rows[i]);
+    }
+    for (int i = 0; i < keptCount; i++) {
+        fputs(kept[i], output);
+        if (kept[i][strlen(kept[i]) - 1] != '\n') {
+            fputc('\n', output);
+        }
+    }
+    fclose(output);
+    if (!write_atomic(argv[2], temp, text, length)) {
+        fprintf(stderr, "Unable to write stats\n");
+        exit(3);
+    }
+    close(lock);
+    exit(0);
+}
+
+/*What each bark -export thread plays and the shard it writes*/
+struct ExportJob {
+    struct Shard shard;
+    char types[2];
+    struct Card* deck;
+    int deckCount;
+    int width;
+    int height;
+    long first;
+    long games;
+    long step;
+};
+
+/*Thread body for bark -export: plays games first, first + step, ... like
+ * stats_thread, recording every move in the thread's own shard*/
+void* export_thread(void* data) {
+    struct ExportJob* job = data;
+    struct Card* deck = malloc(sizeof(struct Card) * job->deckCount);
+    struct Result result;
+    for (long game = job->first; game < job->games; game += job->step) {
+        memcpy(deck, job->deck, sizeof(struct Card) * job->deckCount);
+        shuffle_deck(deck, job->deckCount, (uint64_t)game);
+        simulate_game(job->types[0], job->types[1], deck, job->deckCount, 
+                job->width, job->height, 1 + (int)(game % 2), &result, 
+                &job->shard, NULL);
+    }
+    free(deck);
+    return NULL;
+}
+
+/*Writes training data from automated games: bark -export prefix games 
+ * threads deckfile width height p1type p2type. Games are dealt and played
+ * as bark -stats plays them, and every move is written as a fixed size 
+ * record (see struct Shard) to prefix.0, prefix.1, ..., one file per 
+ * thread. Sparse boards are not exported.*/
+void run_export(int argc, char** argv) {
+    int deckCount = 0;
+    long records = 0;
+    if (argc != 10) {
+        fprintf(stderr, "Usage: bark -export prefix games threads deckfile");
+        fprintf(stderr, " width height p1type p2type\n");
+        exit(1);
+    }
+    long games = atol(argv[3]);
+    int threads = atoi(argv[4]);
+    int width = atoi(argv[6]);
+    int height = atoi(argv[7]);
+    code_check(argv[8], argv[9], width, height);
+    if (games < 1 || threads < 1 || strchr("he", *argv[8]) != NULL || 
+            strchr("he", *argv[9]) != NULL || 
+            (long)width * height > DENSE_CELLS) {
+        fprintf(stderr, "Incorrect arg types\n");
+        exit(2);
+    }
+    struct Card* deck = init_deck(argv[5], &deckCount);
+    struct ExportJob* jobs = calloc(threads, sizeof(struct ExportJob));
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    char* file = malloc(strlen(argv[2]) + 16);
+    quiet = 1;
+    for (int t = 0; t < threads; t++) {
+        sprintf(file, "%s.%d", argv[2], t);
+        if (!shard_open(&jobs[t].shard, file, width, height)) {
+            fprintf(stderr, "Unable to write export\n");
+            exit(3);
+        }
+        jobs[t].types[0] = *argv[8];
+        jobs[t].types[1] = *argv[9];
+        jobs[t].deck = deck;
+        jobs[t].deckCount = deckCount;
+        jobs[t].width = width;
+        jobs[t].height = height;
+        jobs[t].first = t;
+        jobs[t].games = games;
+        jobs[t].step = threads;
+        pthread_create(&ids[t], NULL, export_thread, &jobs[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        records += jobs[t].shard.records;
+        shard_close(&jobs[t].shard);
+    }
+    fprintf(stdout, "Wrote %ld records to %d shards\n", records, threads);
+    exit(0);
+}
+
+/*A match between two sets of 'g' weights in bark -tune. Pairs of games 
+ * are handed out by next; pair n is dealt the deck shuffled by seed n 
+ * twice, with sides[0] moving first in one game and second in the other,
+ * so every match (and every candidate) plays the same deals. Each thread
+ * adds up the margin of sides[0] over sides[1] in each pair.*/
+struct TuneMatch {
+    struct Params sides[2];
+    struct Card* deck;
+    int deckCount;
+    int width;
+    int height;
+    long next;
+    long last;
+};
+
+/*One bark -tune thread's share of a batch*/
+struct TuneJob {
+    struct TuneMatch* match;
+    double sum;
+    double squares;
+    long pairs;
+};
+
+/*Thread body for bark -tune: plays pairs until the batch is done*/
+void* tune_thread(void* data) {
+    struct TuneJob* job = data;
+    struct TuneMatch* match = job->match;
+    struct Card* deck = malloc(sizeof(struct Card) * match->deckCount);
+    struct Params swapped[2] = {match->sides[1], match->sides[0]};
+    struct Result first, second;
+    long pair;
+    while ((pair = __atomic_fetch_add(&match->next, 1, __ATOMIC_RELAXED)) < 
+            match->last) {
+        memcpy(deck, match->deck, sizeof(struct Card) * match->deckCount);
+        shuffle_deck(deck, match->deckCount, (uint64_t)pair);
+        simulate_game('g', 'g', deck, match->deckCount, match->width, 
+                match->height, 1, &first, NULL, match->sides);
+        memcpy(deck, match->deck, sizeof(struct Card) * match->deckCount);
+        shuffle_deck(deck, match->deckCount, (uint64_t)pair);
+        simulate_game('g', 'g', deck, match->deckCount, match->width, 
+                match->height, 1, &second, NULL, swapped);
+        double margin = (first.p1 - first.p2 + second.p2 - second.p1) / 2.0;
+        job->sum += margin;
+        job->squares += margin * margin;
+        job->pairs++;
+    }
+    free(deck);
+    return NULL;
+}
+
+/*Plays a match of up to games games between a and b on threads threads, 
+ * TUNE_BATCH pairs at a time, stopping early once the mean margin is 
+ * TUNE_Z standard errors from 0. Returns the mean margin of a over b per
+ * game and sets *played to the games played.*/
+double tune_match(struct TuneMatch* match, struct Params* a, 
+        struct Params* b, long games, int threads, long* played) {
+    struct TuneJob* jobs = calloc(threads, sizeof(struct TuneJob));
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    double sum = 0, squares = 0, mean = 0;
+    long pairs = 0;
+    match->sides[0] = *a;
+    match->sides[1] = *b;
+    match->next = 0;
+    while (pairs < games / 2) {
+        match->last = pairs + TUNE_BATCH;
+        match->last = (match->last > games / 2) ? games / 2 : match->last;
+        for (int t = 0; t < threads; t++) {
+            memset(&jobs[t], 0, sizeof(struct TuneJob));
+            jobs[t].match = match;
+            pthread_create(&ids[t], NULL, tune_thread, &jobs[t]);
+        }
+        for (int t = 0; t < threads; t++) {
+            pthread_join(ids[t], NULL);
+            sum += jobs[t].sum;
+            squares += jobs[t].squares;
+            pairs += jobs[t].pairs;
+        }
+        match->next = pairs;
+        mean = sum / pairs;
+        double variance = squares / pairs - mean * mean;
+        if (pairs >= TUNE_MIN_PAIRS && fabs(mean) > TUNE_Z * 
+                sqrt((variance > 0 ? variance : 0) / pairs)) {
+            break;
+        }
+    }
+    *played = pairs * 2;
+    free(jobs);
+    free(ids);
+    return mean;
+}
+
+/*Writes weights to file in the form load_params reads*/
+int write_params(char* file, struct Params* weights) {
+    char text[PARAM_COUNT * 40];
+    char* temp = malloc(strlen(file) + 5);
+    size_t length = 0;
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        length += sprintf(text + length, "%s %.6f\n", paramNames[i], 
+                *param_of(weights, paramNames[i]));
+    }
+    sprintf(temp, "%s.tmp", file);
+    int written = write_atomic(file, temp, text, length);
+    free(temp);
+    return written;
+}
+
+/*Tunes the 'g' player's weights by self play: bark -tune paramfile games
+ * threads deckfile width height [iterations]. Starting from the loaded 
+ * weights, each iteration of SPSA nudges every weight but own (the values
+ * only matter relative to each other) up or down at random, plays the 
+ * nudged weights against the opposite nudge in a match of up to games 
+ * games, and moves the weights along the difference. All matches use the
+ * same deals. Finally the tuned weights play the starting ones, and 
+ * whichever did better is written to paramfile.*/
+void run_tune(int argc, char** argv) {
+    struct TuneMatch match;
+    struct Params start;
+    struct Params tuned;
+    long played;
+    if (argc != 8 && argc != 9) {
+        fprintf(stderr, "Usage: bark -tune paramfile games threads deckfile");
+        fprintf(stderr, " width height [iterations]\n");
+        exit(1);
+    }
+    long games = atol(argv[3]);
+    int threads = atoi(argv[4]);
+    int iterations = (argc == 9) ? atoi(argv[8]) : TUNE_ITERATIONS;
+    memset(&match, 0, sizeof(match));
+    match.width = atoi(argv[6]);
+    match.height = atoi(argv[7]);
+    code_check("g", "g", match.width, match.height);
+    start = params;
+    tuned = params;
+    if (games < 2 || threads < 1 || iterations < 0 || 
+            (long)match.width * match.height > DENSE_CELLS) {
+        fprintf(stderr, "Incorrect arg types\n");
+        exit(2);
+    }
+    match.deck = init_deck(argv[5], &match.deckCount);
+    quiet = 1;
+    for (int k = 0; k < iterations; k++) {
+        struct Params up = tuned, down = tuned;
+        double step = TUNE_STEP / pow(k + 1 + iterations / 10.0, 0.602);
+        double perturb = TUNE_PERTURB / pow(k + 1, 0.101);
+        double signs[PARAM_COUNT];
+        for (int i = 1; i < PARAM_COUNT; i++) {
+            signs[i] = (mix_key((uint64_t)k * PARAM_COUNT + i) & 1) ? 1 : -1;
+            *param_of(&up, paramNames[i]) += perturb * signs[i];
+            *param_of(&down, paramNames[i]) -= perturb * signs[i];
+        }
+        double margin = tune_match(&match, &up, &down, games, threads, 
+                &played);
+        for (int i = 1; i < PARAM_COUNT; i++) {
+            double* weight = param_of(&tuned, paramNames[i]);
+            *weight += step * margin / (2 * perturb * signs[i]);
+            *weight = (*weight > TUNE_LIMIT) ? TUNE_LIMIT : *weight;
+            *weight = (*weight < -TUNE_LIMIT) ? -TUNE_LIMIT : *weight;
+        }
+        fprintf(stdout, "Iteration %d: margin %.3f over %ld games,", k + 1, 
+                margin, played);
+        for (int i = 0; i < PARAM_COUNT; i++) {
+            fprintf(stdout, " %s %.3f", paramNames[i], 
+                    *param_of(&tuned, paramNames[i]));
+        }
+        fprintf(stdout, "\n");
+        fflush(stdout);
+    }
+    double margin = tune_match(&match, &tuned, &start, games, threads, 
+            &played);
+    fprintf(stdout, "Tuned weights %s the starting ones (margin %.3f over "
+            "%ld games), writing the %s ones\n", (margin > 0) ? "beat" : 
+            "do not beat", margin, played, (margin > 0) ? "tuned" : 
+            "starting");
+    if (!write_params(argv[2], (margin > 0) ? &tuned : &start)) {
+        fprintf(stderr, "Unable to write params\n");
+        exit(3);
+    }
+    exit(0);
+}
+
+/*A savefile read without playing it: the same fields load_game reads,
+ * with the hands in player order (line 3 is player 1, line 4 player 2)*/
+struct SaveFile {
+    int width;
+    int height;
+    int emptyCards;
+    int turn;
+    char deckName[80];
+    struct Card hands[2][HAND_LIMIT];
+    int handCounts[2];
+    struct Card** board;
+};
+
+/*Reads the next line of text (ending at end or a newline) into line, 
+ * returning where the line after it starts, or NULL at the end*/
+char* next_line(char* text, char* end, char** line, int* length) {
+    char* stop = text;
+    if (text >= end) {
+        return NULL;
+    }
+    while (stop < end && *stop != '\n') {
+        stop++;
+    }
+    *line = text;
+    *length = stop - text;
+    if (*length > 0 && text[*length - 1] == '\r') {
+        --*length;
+    }
+    return (stop < end) ? stop + 1 : end;
+}
+
+/*Checks a hand line the way add_cards reads it (number then suit, up to 
+ * HAND_SIZE cards) and fills in the hand. Returns 0 if the line is not a 
+ * hand.*/
+int parse_hand(char* line, int length, struct Card* theHand, int* count) {
+    *count = 0;
+    memset(theHand, 0, sizeof(struct Card) * HAND_SIZE);
+    if (length % 2 != 0 || length > HAND_SIZE * 2) {
+        return 0;
+    }
+    for (int i = 0; i < length; i += 2) {
+        int number = RANK_VALUE(line[i]);
+        if (number < 1 || number > TOP_RANK || !isalpha(line[i + 1])) {
+            return 0;
+        }
+        theHand[*count].number = number;
+        theHand[*count].suit = toupper(line[i + 1]);
+        ++*count;
+    }
+    return 1;
+}
+
+/*Returns the delta record a savefile is loaded up to, read from 
+ * BARK_SAVE_POINT, or -1 for all of them*/
+int save_point(void) {
+    char* value = getenv("BARK_SAVE_POINT");
+    return (value != NULL && atoi(value) >= 0) ? atoi(value) : -1;
+}
+
+/*Reads the "+ cards player cells" line starting a delta record. Returns 0
+ * if the line is not one.*/
+int parse_delta(char* line, int length, int* emptyCards, int* turn, 
+        long* cells) {
+    char text[64];
+    if (length < 1 || length >= (int)sizeof(text) || line[0] != '+') {
+        return 0;
+    }
+    memcpy(text, line, length);
+    text[length] = '\0';
+    return sscanf(text, "+ %d %d %ld", emptyCards, turn, cells) == 3 && 
+            *emptyCards >= 0 && (*turn == 1 || *turn == 2) && *cells >= 0;
+}
+
+/*Reads a "col row card" line of a delta record and places the card on 
+ * board. Returns 0 if the line is not one or the cell is off the board.*/
+int parse_cell(char* line, int length, struct Card** board, int width, 
+        int height) {
+    char text[64];
+    int col, row;
+    char number, suit;
+    if (length >= (int)sizeof(text)) {
+        return 0;
+    }
+    memcpy(text, line, length);
+    text[length] = '\0';
+    if (sscanf(text, "%d %d %c%c", &col, &row, &number, &suit) != 4 || 
+            col < 1 || col > width || row < 1 || row > height ||
+            RANK_VALUE(number) < 1 || RANK_VALUE(number) > TOP_RANK || 
+            !isalpha(suit)) {
+        return 0;
+    }
+    struct Card loaded = {suit, RANK_VALUE(number), 1};
+    place_card(board, col, row, loaded);
+    return 1;
+}
+
+/*Parses a savefile held in memory (as written by save_game) into save,
+ * creating its board and playing its delta records up to the save point.
+ * Nothing is printed and nothing exits: the return 
+ * value is 0 if the file is fine, otherwise the exit status load_game 
+ * would have given (2 bad size, 3 bad hand or deck name, 4 bad savefile,
+ * 6 full board).*/
+int parse_save(char* text, size_t size, struct SaveFile* save) {
+    char* end = text + size;
+    char* line;
+    int length;
+    char first[64];
+    save->board = NULL;
+    text = next_line(text, end, &line, &length);
+    if (text == NULL || length >= (int)sizeof(first)) {
+        return 4;
+    }
+    memcpy(first, line, length);
+    first[length] = '\0';
+    if (sscanf(first, "%d %d %d %d", &save->width, &save->height, 
+            &save->emptyCards, &save->turn) != 4 || 
+            (save->turn != 1 && save->turn != 2) || save->emptyCards < 0) {
+        return 4;
+    }
+    if (save->width < MIN_SIZE || save->width > MAX_SIZE || 
+            save->height < MIN_SIZE || save->height > MAX_SIZE) {
+        return 2;
+    }
+    text = next_line(text, end, &line, &length);
+    if (text == NULL || length == 0 || length >= (int)sizeof(save->deckName)
+            || line[length - 1] == '/') {
+        return 3;
+    }
+    memcpy(save->deckName, line, length);
+    save->deckName[length] = '\0';
+    for (int p = 0; p < 2; p++) {
+        text = next_line(text, end, &line, &length);
+        if (text == NULL || !parse_hand(line, length, save->hands[p], 
+                &save->handCounts[p])) {
+            return 3;
+        }
+    }
+    save->board = create_board(save->width, save->height);
+    if (board_tiles(save->board) != NULL) {
+        long cells = -1;
+        text = next_line(text, end, &line, &length);
+        if (text != NULL && length > 0 && length < (int)sizeof(first)) {
+            memcpy(first, line, length);
+            first[length] = '\0';
+            sscanf(first, "%ld", &cells);
+        }
+        if (cells < 0) {
+            return 4;
+        }
+        for (long c = 0; c < cells; c++) {
+            text = next_line(text, end, &line, &length);
+            if (text == NULL || !parse_cell(line, length, save->board, 
+                    save->width, save->height)) {
+                return 4;
+            }
+        }
+    } else {
+        for (int i = 1; i < save->height + 1; i++) {
+            text = next_line(text, end, &line, &length);
+            if (text == NULL || length != save->width * 2) {
+                return 4;
+            }
+            for (int j = 1; j < save->width + 1; j++) {
+                char number = line[j * 2 - 2];
+                char suit = line[j * 2 - 1];
+                if (number == '*' && suit == '*') {
+                    continue;
+                } else if (RANK_VALUE(number) >= 1 && 
+                        RANK_VALUE(number) <= TOP_RANK && isalpha(suit)) {
+                    struct Card loaded = {suit, RANK_VALUE(number), 1};
+                    place_card(save->board, j, i, loaded);
+                } else {
+                    return 4;
+                }
+            }
+        }
+    }
+    int point = save_point();
+    for (int n = 0; n != point; n++) {
+        long cells;
+        text = next_line(text, end, &line, &length);
+        if (text == NULL) {
+            break;
+        }
+        if (!parse_delta(line, length, &save->emptyCards, &save->turn, 
+                &cells)) {
+            return 4;
+        }
+        for (int p = 0; p < 2; p++) {
+            text = next_line(text, end, &line, &length);
+            if (text == NULL || !parse_hand(line, length, save->hands[p], 
+                    &save->handCounts[p])) {
+                return 3;
+            }
+        }
+        for (long c = 0; c < cells; c++) {
+            text = next_line(text, end, &line, &length);
+            if (text == NULL || !parse_cell(line, length, save->board, 
+                    save->width, save->height)) {
+                return 4;
+            }
+        }
+    }
+    return is_board_full(save->board, save->width, save->height) ? 6 : 0;
+}
+
+/*Frees the board of a parsed savefile*/
+void free_save(struct SaveFile* save) {
+    if (save->board != NULL) {
+        free_board(save->board, save->width);
+        save->board = NULL;
+    }
+}
+
+/*Maps a whole file read only and parses it with parse_save. Returns 4 if 
+ * the file cannot be opened, like load_game.*/
+int map_save(char* file, struct SaveFile* save) {
+    struct stat info;
+    int fd = open(file, O_RDONLY);
+    int status;
+    save->board = NULL;
+    if (fd < 0) {
+        return 4;
+    }
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return 4;
+    }
+    char* text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        return 4;
+    }
+    status = parse_save(text, info.st_size, save);
+    munmap(text, info.st_size);
+    return status;
+}
+
+/*Message printed for each parse_save status, matching load_game's*/
+char* save_error(int status) {
+    switch (status) {
+        case 2:
+            return "Incorrect arg types";
+        case 3:
+            return "Unable to load";
+        case 6:
+            return "Board full";
+        default:
+            return "Unable to parse savefile";
+    }
+}
+
+/*The files of one bark -score run and what each scored*/
+struct ScoreJob {
+    char** files;
+    int* status;
+    int* scores;
+    long count;
+    long next;
+};
+
+/*Thread body for bark -score: takes the next unscored file until none are
+ * left, scoring its board as it stands*/
+void* score_thread(void* data) {
+    struct ScoreJob* job = data;
+    struct SaveFile save;
+    long i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < 
+            job->count) {
+        job->status[i] = map_save(job->files[i], &save);
+        if (job->status[i] == 0) {
+            best_scores(save.board, save.width, save.height, NULL, 0, 
+                    &job->scores[i * 2], &job->scores[i * 2 + 1]);
+        }
+        free_save(&save);
+    }
+    return NULL;
+}
+
+/*Adds file to the list, or every file in it if it is a directory*/
+void add_score_file(char* file, char*** files, long* count, long* space) {
+    struct stat info;
+    if (stat(file, &info) == 0 && S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(file);
+        struct dirent* item;
+        while (dir != NULL && (item = readdir(dir)) != NULL) {
+            if (item->d_name[0] == '.') {
+                continue;
+            }
+            char* path = malloc(strlen(file) + strlen(item->d_name) + 2);
+            sprintf(path, "%s/%s", file, item->d_name);
+            if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+                add_score_file(path, files, count, space);
+            } else {
+                free(path);
+            }
+        }
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        return;
+    }
+    if (*count == *space) {
+        *space = (*space == 0) ? 1024 : *space * 2;
+        *files = realloc(*files, sizeof(char*) * *space);
+    }
+    (*files)[(*count)++] = file;
+}
+
+/*Scores savefiles without playing them: bark -score threads file|dir...
+ * Every board is scored as it was saved with the cal_score rules and one 
+ * line is printed per file, either its scores or why it would not load.
+ * Exits with 4 if any file failed.*/
+void run_score(int argc, char** argv) {
+    struct ScoreJob job;
+    long space = 0;
+    int failed = 0;
+    if (argc < 4 || atoi(argv[2]) < 1) {
+        fprintf(stderr, "Usage: bark -score threads savefile|dir...\n");
+        exit(1);
+    }
+    int threads = atoi(argv[2]);
+    job.files = NULL;
+    job.count = 0;
+    job.next = 0;
+    for (int i = 3; i < argc; i++) {
+        add_score_file(argv[i], &job.files, &job.count, &space);
+    }
+    job.status = malloc(sizeof(int) * (job.count + 1));
+    job.scores = malloc(sizeof(int) * 2 * (job.count + 1));
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&ids[t], NULL, score_thread, &job);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    for (long i = 0; i < job.count; i++) {
+        if (job.status[i] == 0) {
+            fprintf(stdout, "%s: Player 1=%d Player 2=%d\n", job.files[i], 
+                    job.scores[i * 2], job.scores[i * 2 + 1]);
+        } else {
+            fprintf(stdout, "%s: %s\n", job.files[i], 
+                    save_error(job.status[i]));
+            failed = 1;
+        }
+    }
+    exit(failed ? 4 : 0);
+}
+
+/*Running totals of bark -analyze, shared by its threads under lock. 
+ * deck is the savefile's deck with the cards already dealt at the front.
+ * done is set once the answer is precise enough or limit games have been 
+ * played.*/
+struct Analysis {
+    struct SaveFile save;
+    struct Card* deck;
+    int deckCount;
+    char types[2];
+    long limit;
+    double precision;
+    long games;
+    long wins[2];
+    double sums[2];
+    double squares[2];
+    int done;
+    pthread_mutex_t lock;
+};
+
+/*One bark -analyze thread and the seed of its own random numbers*/
+struct AnalysisJob {
+    struct Analysis* analysis;
+    uint64_t seed;
+};
+
+/*Works out the win chance of player (0 or 1) and how far either side of
+ * it the true chance may be (Wilson score interval)*/
+double win_chance(struct Analysis* analysis, int player, double* spread) {
+    double n = analysis->games;
+    double p = analysis->wins[player] / n;
+    double z = ANALYZE_Z;
+    double scale = 1 + z * z / n;
+    *spread = z / scale * sqrt(p * (1 - p) / n + z * z / (4 * n * n));
+    return (p + z * z / (2 * n)) / scale;
+}
+
+/*Works out the mean final score of player (0 or 1) and how far either 
+ * side of it the true mean may be*/
+double mean_score(struct Analysis* analysis, int player, double* spread) {
+    double n = analysis->games;
+    double mean = analysis->sums[player] / n;
+    double variance = analysis->squares[player] / n - mean * mean;
+    *spread = (n > 1 && variance > 0) ? 
+            ANALYZE_Z * sqrt(variance / (n - 1)) : 0;
+    return mean;
+}
+
+/*Prints the estimates so far, each with its confidence interval*/
+void print_analysis(struct Analysis* analysis) {
+    double spreads[4];
+    double chances[2], scores[2];
+    for (int p = 0; p < 2; p++) {
+        chances[p] = win_chance(analysis, p, &spreads[p]);
+        scores[p] = mean_score(analysis, p, &spreads[p + 2]);
+    }
+    fprintf(stdout, "Games %ld: Player 1 wins %.3f+-%.3f scores %.2f+-%.2f"
+            ", Player 2 wins %.3f+-%.3f scores %.2f+-%.2f\n", 
+            analysis->games, chances[0], spreads[0], scores[0], spreads[2],
+            chances[1], spreads[1], scores[1], spreads[3]);
+    fflush(stdout);
+}
+
+/*Adds a game to the totals, printing them each time the number of games 
+ * doubles, and says when to stop*/
+void analysis_add(struct Analysis* analysis, struct Result* result) {
+    double spread;
+    pthread_mutex_lock(&analysis->lock);
+    if (!analysis->done) {
+        int scores[2] = {result->p1, result->p2};
+        analysis->games++;
+        analysis->wins[0] += (result->p1 > result->p2);
+        analysis->wins[1] += (result->p2 > result->p1);
+        for (int p = 0; p < 2; p++) {
+            analysis->sums[p] += scores[p];
+            analysis->squares[p] += (double)scores[p] * scores[p];
+        }
+        if ((analysis->games & (analysis->games - 1)) == 0 && 
+                analysis->games >= 16) {
+            print_analysis(analysis);
+        }
+        int precise = analysis->games >= ANALYZE_MIN_GAMES;
+        for (int p = 0; p < 2 && precise; p++) {
+            win_chance(analysis, p, &spread);
+            precise = spread <= analysis->precision;
+        }
+        analysis->done = precise || analysis->games >= analysis->limit;
+    }
+    pthread_mutex_unlock(&analysis->lock);
+}
+
+/*Thread body for bark -analyze: plays the position out over and over, 
+ * each time with the cards not yet dealt shuffled by the thread's own 
+ * random numbers, until the totals are done*/
+void* analysis_thread(void* data) {
+    struct AnalysisJob* job = data;
+    struct Analysis* analysis = job->analysis;
+    struct SaveFile* save = &analysis->save;
+    struct Card* deck = malloc(sizeof(struct Card) * analysis->deckCount);
+    struct Card hands[2][HAND_LIMIT];
+    struct Result result;
+    uint64_t seed = job->seed;
+    while (!__atomic_load_n(&analysis->done, __ATOMIC_RELAXED)) {
+        int handCounts[2] = {save->handCounts[0], save->handCounts[1]};
+        struct Card** board = copy_board(save->board, save->width, 
+                save->height);
+        memcpy(deck, analysis->deck, sizeof(struct Card) * 
+                analysis->deckCount);
+        memcpy(hands, save->hands, sizeof(hands));
+        seed = mix_key(seed);
+        shuffle_deck(deck + save->emptyCards, analysis->deckCount - 
+                save->emptyCards, seed);
+        play_out(analysis->types, hands, handCounts, board, deck, 
+                analysis->deckCount, save->emptyCards, save->width, 
+                save->height, save->turn, &result, NULL, NULL);
+        free_board(board, save->width);
+        analysis_add(analysis, &result);
+    }
+    free(deck);
+    return NULL;
+}
+
+/*Estimates how a saved game will end: bark -analyze savefile games 
+ * threads p1type p2type [precision]. The position is loaded as load_game 
+ * would and played out by the two automated types up to games times, 
+ * each time with the rest of the deck in a new random order, and the 
+ * chance of each player winning and their mean final score are printed 
+ * with confidence intervals as the games come in. It stops early once 
+ * both chances of winning are known to within precision.*/
+void run_analysis(int argc, char** argv) {
+    struct Analysis analysis;
+    if (argc != 7 && argc != 8) {
+        fprintf(stderr, "Usage: bark -analyze savefile games threads p1type");
+        fprintf(stderr, " p2type [precision]\n");
+        exit(1);
+    }
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.limit = atol(argv[3]);
+    int threads = atoi(argv[4]);
+    analysis.precision = (argc == 8) ? atof(argv[7]) : ANALYZE_PRECISION;
+    code_check(argv[5], argv[6], MIN_SIZE, MIN_SIZE);
+    if (analysis.limit < 1 || threads < 1 || analysis.precision <= 0 || 
+            strchr("he", *argv[5]) != NULL || 
+            strchr("he", *argv[6]) != NULL) {
+        fprintf(stderr, "Incorrect arg types\n");
+        exit(2);
+    }
+    analysis.types[0] = *argv[5];
+    analysis.types[1] = *argv[6];
+    int status = map_save(argv[2], &analysis.save);
+    if (status != 0) {
+        fprintf(stderr, "%s\n", save_error(status));
+        exit(status);
+    }
+    analysis.deck = init_deck(analysis.save.deckName, &analysis.deckCount);
+    if (analysis.save.emptyCards > analysis.deckCount) {
+        fprintf(stderr, "%s\n", save_error(4));
+        exit(4);
+    }
+    for (int i = 0; i < analysis.save.emptyCards; i++) {
+        analysis.deck[i].number = 0;
+    }
+    quiet = 1;
+    pthread_mutex_init(&analysis.lock, NULL);
+    struct AnalysisJob* jobs = calloc(threads, sizeof(struct AnalysisJob));
+    pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++) {
+        jobs[t].analysis = &analysis;
+        jobs[t].seed = mix_key(((uint64_t)t << 32) ^ (uint64_t)time(NULL));
+        pthread_create(&ids[t], NULL, analysis_thread, &jobs[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+    print_analysis(&analysis);
+    exit(0);
+}
+
+/*A spectator for the event ring: bark -watch name. Waits for the ring to
+ * be created, then prints every event as it is published, starting from 
+ * the newest. If it falls behind far enough
+ * for events to be overwritten it says how many were missed and carries on
+ * from the oldest event still in the ring.*/
+void watch_events(int argc, char** argv) {
+    struct Event event;
+    struct timespec pause = {0, 1000000};
+    if (argc != 3) {
+        fprintf(stderr, "Usage: bark -watch name\n");
+        exit(1);
+    }
+    struct EventRing* ring;
+    while ((ring = map_events(argv[2], 0)) == NULL) {
+        struct timespec wait = {0, 100000000};
+        nanosleep(&wait, NULL);
+    }
+    uint64_t n = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (1) {
+        int status = read_event(ring, n, &event);
+        if (status == 0) {
+            nanosleep(&pause, NULL);
+            continue;
+        } else if (status < 0) {
+            uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            uint64_t oldest = head - EVENT_SLOTS / 2;
+            fprintf(stdout, "Missed %llu events\n", 
+                    (unsigned long long)(oldest - n));
+            n = oldest;
+            continue;
+        }
+        if (event.type == EVENT_START) {
+            fprintf(stdout, "Start %d %d\n", event.col, event.row);
+        } else if (event.type == EVENT_HAND) {
+            fprintf(stdout, "Hand(%d):", event.player);
+            for (int i = 0; i < HAND_LIMIT && event.cards[i][0] != 0; i++) {
+                fprintf(stdout, " %c%c", RANK_CHAR(event.cards[i][0]), 
+                        event.cards[i][1]);
+            }
+            fprintf(stdout, "\n");
+        } else if (event.type == EVENT_PLACE) {
+            fprintf(stdout, "Player %d plays %c%c in column %d row %d\n", 
+                    event.player, RANK_CHAR(event.cards[0][0]), 
+                    event.cards[0][1], 
+                    event.col, event.row);
+        } else if (event.type == EVENT_SAVE) {
+            fprintf(stdout, "Player %d saved %.20s\n", event.player, 
+                    event.name);
+        } else if (event.type == EVENT_SCORE) {
+            fprintf(stdout, "Player 1=%d Player 2=%d\n", event.p1, event.p2);
+        }
+        fflush(stdout);
+        n++;
+    }
+}
+
+/*Reads a line of a savefile being loaded into line (grown as needed), 
+ * returning its length without the line break, or -1 at the end*/
+int read_save_line(FILE* load, char** line, size_t* space) {
+    ssize_t length = getline(line, space, load);
+    while (length > 0 && ((*line)[length - 1] == '\n' || 
+            (*line)[length - 1] == '\r')) {
+        length--;
+    }
+    return (int)length;
+}
+
+/*Reads the board of a savefile for a sparse board (see format_save) onto 
+ * board. Exits as load_game does if it is bad.*/
+void load_cells(FILE* load, int width, int height, struct Card** board) {
+    char* line = NULL;
+    size_t space = 0;
+    long cells = -1;
+    int length = read_save_line(load, &line, &space);
+    if (length > 0 && length < 32) {
+        line[length] = '\0';
+        sscanf(line, "%ld", &cells);
+    }
+    for (long c = 0; c < cells; c++) {
+        length = read_save_line(load, &line, &space);
+        if (length < 0 || !parse_cell(line, length, board, width, height)) {
+            cells = -1;
+        }
+    }
+    free(line);
+    if (cells < 0) {
+        fprintf(stderr, "%s\n", save_error(4));
+        exit(4);
+    }
+}
+
+/*Plays the delta records after the board of a savefile being loaded onto
+ * board, up to the save point, updating the cards dealt, the player to 
+ * move and both hands. Exits as load_game does if a record is bad.*/
+void load_deltas(FILE* load, int width, int height, struct Card** board, 
+        int* emptyCards, int* turn, struct Card* p1Hand, int* p1HandCount,
+        struct Card* p2Hand, int* p2HandCount) {
+    char* line = NULL;
+    size_t space = 0;
+    int status = 0;
+    int point = save_point();
+    for (int n = 0; n != point && status == 0; n++) {
+        long cells;
+        int length = read_save_line(load, &line, &space);
+        if (length < 0) {
+            break;
+        }
+        if (!parse_delta(line, length, emptyCards, turn, &cells)) {
+            status = 4;
+        }
+        for (int p = 0; p < 2 && status == 0; p++) {
+            length = read_save_line(load, &line, &space);
+            if (length < 0 || !parse_hand(line, length, (p == 0) ? p1Hand : 
+                    p2Hand, (p == 0) ? p1HandCount : p2HandCount)) {
+                status = 3;
+            }
+        }
+        for (long c = 0; c < cells && status == 0; c++) {
+            length = read_save_line(load, &line, &space);
+            if (length < 0 || !parse_cell(line, length, board, width, 
+                    height)) {
+                status = 4;
+            }
+        }
+    }
+    free(line);
+    if (status != 0) {
+        fprintf(stderr, "%s\n", save_error(status));
+        exit(status);
+    }
+}
+
+/*Loads the game from a given file by reading each line and returning 
+ * it as a string, and basis player types on an input.
+ * Once the loaded game is over, it will call the cal_score function
+ * and return the scores of the game.*/
+void load_game(char* argv[]) { 
+    struct Card* p1Hand = calloc(HAND_SIZE, sizeof(struct Card));
+    struct Card* p2Hand = calloc(HAND_SIZE, sizeof(struct Card));
+    int p1HandCount = 0;
+    int p2HandCount = 0;
+    int deckCount = 0;
+    int width, height, emptyCards, turn;
+    FILE* load = fopen(argv[1], "r");
+    char* deckName = malloc(sizeof(char) * 20);
+    int lineNo = 2;
+    code_check(argv[2], argv[3], 3, 3);
+    if (load == NULL) {
+        fprintf(stderr, "Unable to parse savefile\n");
+        exit(4);
+    }
+    char* firstLine = read_line(load);
+    sscanf(firstLine, "%d %d %d %d", &width, &height, &emptyCards, &turn);
+    struct Card** board = create_board(width, height);
+    struct Event event = new_event(EVENT_START, turn);
+    event.col = width;
+    event.row = height;
+    publish_event(&event);
+    struct Card* fullDeck = malloc(sizeof(struct Card) * deckCount);
+    code_check(argv[2], argv[3], width, height);
+    while (1) {
+        char* temp = read_line(load);
+        if (lineNo == 2) {
+            sscanf(temp, "%s", deckName);
+            if (deckName[strlen(deckName) - 1] == '/') {
+                fprintf(stderr, "Unable to parse deckfile\n");
+                exit(3);
+            }
+            fullDeck = init_deck(deckName, &deckCount);
+            lineNo++;
+        } else if (lineNo == 3) {
+            char* temps = malloc(sizeof(char) * (HAND_LIMIT * 2 + 8));
+            sscanf(temp, "%s", temps);
+            add_cards(p1Hand, temps, &p1HandCount);    
+            lineNo++;
+        } else if (lineNo == 4) {
+            char* temps = malloc(sizeof(char) * (HAND_LIMIT * 2 + 8));
+            sscanf(temp, "%s", temps);
+            add_cards(p2Hand, temps, &p2HandCount);
+            lineNo++;
+            if (board_tiles(board) != NULL) {
+                load_cells(load, width, height, board);
+            } else {
+                load_board(load, height, width, board);
+            }
+            load_deltas(load, width, height, board, &emptyCards, &turn, 
+                    p1Hand, &p1HandCount, p2Hand, &p2HandCount);
+            draw_board(board, width, height);
+            if (is_board_full(board, width, height)) {
+                fprintf(stderr, "Board full");
+                exit(6);
+            }
+            play_game(argv[2], argv[3], deckName, p1Hand, p2Hand, board, 
+                    fullDeck, &deckCount, &p1HandCount, &p2HandCount, 
+                    &emptyCards, width, height, turn);
+            break;
+        }
+
+    }
+    if(is_game_over(board, &deckCount, &emptyCards, width, height)) { 
+        cal_score(board, width, height);
+    }
+}
+
+/*Prints the final scores of a table played by run_tables and frees it*/
+void finish_table(struct Game* game) {
+    int p1, p2;
+    best_scores(game->board, game->width, game->height, NULL, 0, &p1, &p2);
+    printf("Table %d: Player 1=%d Player 2=%d\n", game->number, p1, p2);
+    fflush(stdout);
+    for (int side = 0; side < 2; side++) {
+        stop_engine(game->engines[side]);
+        game->engines[side] = NULL;
+        free(game->hands[side]);
+    }
+    free_board(game->board, game->width);
+    free(game->deck);
+}
+
+/*Plays many games at once on one thread: bark -tables tablefile, where 
+ * each line of tablefile is "deck width height p1type p2type". Games are
+ * played as far as they can go and a game waiting on an external engine 
+ * does not hold up the others (see run_games), so a table of slow engines
+ * costs no more time than the slowest. Each table's scores are printed as
+ * it ends. Humans cannot sit at a table.*/
+void run_tables(int argc, char** argv) {
+    FILE* file;
+    int count = 0;
+    struct Game* games = NULL;
+    if (argc != 3) {
+        fprintf(stderr, "Usage: bark -tables tablefile\n");
+        exit(1);
+    }
+    if ((file = fopen(argv[2], "r")) == NULL) {
+        fprintf(stderr, "Unable to parse tablefile\n");
+        exit(3);
+    }
+    quiet = 1;
+    while (!feof(file)) {
+        char* line = read_line(file);
+        char deckName[80], p1[2], p2[2];
+        int width, height;
+        if (sscanf(line, "%79s %d %d %1s %1s", deckName, &width, &height, 
+                p1, p2) != 5) {
+            free(line);
+            continue;
+        }
+        free(line);
+        code_check(p1, p2, width, height);
+        if (*p1 == 'h' || *p2 == 'h') {
+            fprintf(stderr, "Incorrect arg types\n");
+            exit(2);
+        }
+        games = realloc(games, sizeof(struct Game) * (count + 1));
+        struct Game* game = &games[count];
+        memset(game, 0, sizeof(struct Game));
+        game->number = ++count;
+        game->types[0] = *p1;
+        game->types[1] = *p2;
+        game->deckName = strdup(deckName);
+        game->deck = init_deck(deckName, &game->deckCount);
+        for (int side = 0; side < 2; side++) {
+            game->hands[side] = calloc(HAND_SIZE, sizeof(struct Card));
+            hand(game->deck, &game->deckCount, &game->handCounts[side], 
+                    game->hands[side], &game->emptyCards);
+            if (game->types[side] == 'e' && 
+                    (game->engines[side] = start_engine()) == NULL) {
+                fprintf(stderr, "Unable to start engine\n");
+                exit(2);
+            }
+        }
+        game->board = create_board(width, height);
+        game->width = width;
+        game->height = height;
+        game->turn = 1;
+        game->wait = -1;
+    }
+    fclose(file);
+    run_games(games, count, finish_table);
+    for (int g = 0; g < count; g++) {
+        free(games[g].deckName);
+    }
+    free(games);
+    exit(0);
+}
+
+/*Starts a new game given paramaters and player types. If the game ends 
+ * cal_score is called and the scores are printed and the game ends.*/
+void start_game(char* argv[]) {
+    int deckCount = 0;
+    int emptyCards = 0;
+    struct Card** board;
+    int p1HandCount = 0;
     int p2HandCount = 0;
     int width = atoi(argv[2]);
     int height = atoi(argv[3]);
@@ -1104,13 +6567,17 @@ void start_game(char* argv[]) {
     deckName = argv[1];
     struct Card* fullDeck = init_deck(deckName, &deckCount);
     struct Card* p1Hand;
-    p1Hand = malloc(sizeof(struct Card) * 6);
+    p1Hand = calloc(HAND_SIZE, sizeof(struct Card));
     struct Card* p2Hand;
-    p2Hand = malloc(sizeof(struct Card) * 6);
+    p2Hand = calloc(HAND_SIZE, sizeof(struct Card));
     hand(fullDeck, &deckCount, &p1HandCount, p1Hand, &emptyCards);
     hand(fullDeck, &deckCount, &p2HandCount, p2Hand, &emptyCards);
 
     board = create_board(width, height);
+    struct Event event = new_event(EVENT_START, 1);
+    event.col = width;
+    event.row = height;
+    publish_event(&event);
     draw_board(board, width, height);
     play_game(argv[4], argv[5], deckName, p1Hand, p2Hand, board, fullDeck, 
             &deckCount, &p1HandCount, &p2HandCount, &emptyCards, width, 
@@ -1125,7 +6592,34 @@ void start_game(char* argv[]) {
 }
 
 
-/*int main(int argc, char** argv) {
+int main(int argc, char** argv) {
+#ifdef BARK_VARIANTS
+    load_rules();
+#endif
+    if (argc > 1 && strcmp(argv[1], "-book") == 0) {
+        build_book(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-stats") == 0) {
+        run_stats(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-score") == 0) {
+        run_score(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-watch") == 0) {
+        watch_events(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-tables") == 0) {
+        run_tables(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-analyze") == 0) {
+        run_analysis(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-export") == 0) {
+        run_export(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "-tune") == 0) {
+        run_tune(argc, argv);
+    }
     if (argc != 6 && argc != 4) {  
         fprintf(stderr, "Usage: bark savefile p1type p2type\nbark deck width");
         fprintf(stderr, " height p1type p2type\n");
@@ -1135,14 +6629,5 @@ void start_game(char* argv[]) {
     } else if (argc == 4) {
         load_game(argv);
     }
-    return 0;
-}*/
-
-int sarray(int n, int t, int* values) {
-    
-
-int main(int argc, char** argv) {
-    
-
     return 0;
 }